@@ -1,3 +1,6 @@
+#define _GNU_SOURCE // strptime, timegm
+#include <pthread.h>
+#include <time.h>
 #include "io_helper.h"
 #include "request.h"
 
@@ -7,6 +10,39 @@
 //
 
 #define MAXBUF (8192)
+#define MAXTAG (64)
+
+#define HTTP_DATE_FORMAT "%a, %d %b %Y %H:%M:%S GMT"
+
+//
+// A file as of the stat() done for this request, with its validators
+//
+typedef struct {
+    struct stat sbuf;
+    char etag[MAXTAG];
+    char last_modified[MAXTAG];
+} file_info_t;
+
+//
+// Small direct-mapped cache of formatted validators (ETag, Last-Modified),
+// keyed on the inode, mtime and size they are derived from, so they are
+// only formatted again when the file changes. Files are still stat()ed on
+// every request; only the formatting is saved. Shared by all threads.
+//
+#define VALIDATOR_CACHE_SIZE (64)
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    char etag[MAXTAG];
+    char last_modified[MAXTAG];
+    int valid;
+} validator_entry_t;
+
+static validator_entry_t validator_cache[VALIDATOR_CACHE_SIZE];
+static pthread_mutex_t validator_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void request_error(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
     char buf[MAXBUF], body[MAXBUF];
@@ -38,18 +74,133 @@ void request_error(int fd, char *cause, char *errnum, char *shortmsg, char *long
 }
 
 //
-// Reads and discards everything up to an empty text line
+// Copies the value of header line buf into value if its name matches
+// (case-insensitively); leading blanks and the trailing CRLF are dropped
 //
-void request_read_headers(int fd) {
+int request_header_value(char *buf, char *name, char *value) {
+    size_t len = strlen(name);
+    char *end;
+    
+    if (strncasecmp(buf, name, len) || buf[len] != ':')
+	return 0;
+    buf += len + 1;
+    while (*buf == ' ' || *buf == '\t')
+	buf++;
+    strcpy(value, buf);
+    end = value + strlen(value);
+    while (end > value && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' '))
+	*--end = '\0';
+    return 1;
+}
+
+//
+// Reads everything up to an empty text line, keeping only the
+// conditional GET validators (empty string if absent)
+//
+void request_read_headers(int fd, char *if_none_match, char *if_modified_since) {
     char buf[MAXBUF];
     
+    strcpy(if_none_match, "");
+    strcpy(if_modified_since, "");
     readline_or_die(fd, buf, MAXBUF);
     while (strcmp(buf, "\r\n")) {
+	if (!request_header_value(buf, "If-None-Match", if_none_match))
+	    request_header_value(buf, "If-Modified-Since", if_modified_since);
 	readline_or_die(fd, buf, MAXBUF);
     }
     return;
 }
 
+//
+// stat() filename into info, taking its validators from the cache.
+// Returns -1 if the file is missing.
+//
+int request_stat(char *filename, file_info_t *info) {
+    struct stat *sb = &info->sbuf;
+    validator_entry_t *e;
+    
+    if (stat(filename, sb) < 0)
+	return -1;
+    e = &validator_cache[((unsigned long) sb->st_ino * 31 + (unsigned long) sb->st_mtime)
+			 % VALIDATOR_CACHE_SIZE];
+    pthread_mutex_lock(&validator_lock);
+    if (!e->valid || e->dev != sb->st_dev || e->ino != sb->st_ino ||
+	e->mtime != sb->st_mtime || e->size != sb->st_size) {
+	sprintf(e->etag, "\"%lx-%lx-%lx\"",
+		(unsigned long) sb->st_ino,
+		(unsigned long) sb->st_mtime,
+		(unsigned long) sb->st_size);
+	struct tm tm;
+	strftime(e->last_modified, MAXTAG, HTTP_DATE_FORMAT, gmtime_r(&sb->st_mtime, &tm));
+	e->dev = sb->st_dev;
+	e->ino = sb->st_ino;
+	e->mtime = sb->st_mtime;
+	e->size = sb->st_size;
+	e->valid = 1;
+    }
+    strcpy(info->etag, e->etag);
+    strcpy(info->last_modified, e->last_modified);
+    pthread_mutex_unlock(&validator_lock);
+    return 0;
+}
+
+//
+// Return 1 if the comma-separated If-None-Match list holds "*" or an
+// entity tag equal to etag; a weak tag (W/"...") matches its strong
+// form, the weak comparison RFC 7232 asks for here
+//
+int request_etag_match(char *list, char *etag) {
+    size_t len = strlen(etag);
+    char *p = list, *start;
+    
+    while (*p != '\0') {
+	while (*p == ' ' || *p == '\t' || *p == ',')
+	    p++;
+	if (*p == '\0')
+	    break;
+	start = p;
+	if (!strncmp(p, "W/", 2))
+	    p += 2;
+	if (*p == '"') {
+	    // quoted tag: it ends at the closing quote, commas and all
+	    for (p++; *p != '\0' && *p != '"'; p++)
+		;
+	    if (*p == '"')
+		p++;
+	} else {
+	    while (*p != '\0' && *p != ',' && *p != ' ' && *p != '\t')
+		p++;
+	}
+	if (p - start == 1 && *start == '*')
+	    return 1;
+	if (!strncmp(start, "W/", 2))
+	    start += 2;
+	if ((size_t) (p - start) == len && !strncmp(start, etag, len))
+	    return 1;
+	while (*p != '\0' && *p != ',')
+	    p++;
+    }
+    return 0;
+}
+
+//
+// Return 1 if the client's cached copy is still current.
+// If-None-Match takes precedence over If-Modified-Since (RFC 7232).
+//
+int request_not_modified(file_info_t *info, char *if_none_match, char *if_modified_since) {
+    struct tm tm;
+    
+    if (if_none_match[0] != '\0')
+	return request_etag_match(if_none_match, info->etag);
+    if (if_modified_since[0] != '\0') {
+	memset(&tm, 0, sizeof(tm));
+	if (strptime(if_modified_since, HTTP_DATE_FORMAT, &tm) == NULL)
+	    return 0;
+	return info->sbuf.st_mtime <= timegm(&tm);
+    }
+    return 0;
+}
+
 //
 // Return 1 if static, 0 if dynamic content
 // Calculates filename (and cgiargs, for dynamic) from uri
@@ -114,8 +265,23 @@ void request_serve_dynamic(int fd, char *filename, char *cgiargs) {
     }
 }
 
-void request_serve_static(int fd, char *filename, int filesize) {
+void request_serve_not_modified(int fd, file_info_t *info) {
+    char buf[MAXBUF];
+    
+    // no body, and the file itself is never opened
+    sprintf(buf, ""
+	    "HTTP/1.0 304 Not Modified\r\n"
+	    "Server: OSTEP WebServer\r\n"
+	    "ETag: %s\r\n"
+	    "Last-Modified: %s\r\n\r\n",
+	    info->etag, info->last_modified);
+    
+    write_or_die(fd, buf, strlen(buf));
+}
+
+void request_serve_static(int fd, char *filename, file_info_t *info) {
     int srcfd;
+    int filesize = info->sbuf.st_size;
     char *srcp, filetype[MAXBUF], buf[MAXBUF];
     
     request_get_filetype(filename, filetype);
@@ -131,8 +297,10 @@ void request_serve_static(int fd, char *filename, int filesize) {
 	    "HTTP/1.0 200 OK\r\n"
 	    "Server: OSTEP WebServer\r\n"
 	    "Content-Length: %d\r\n"
-	    "Content-Type: %s\r\n\r\n", 
-	    filesize, filetype);
+	    "Content-Type: %s\r\n"
+	    "ETag: %s\r\n"
+	    "Last-Modified: %s\r\n\r\n", 
+	    filesize, filetype, info->etag, info->last_modified);
     
     write_or_die(fd, buf, strlen(buf));
     
@@ -145,8 +313,10 @@ void request_serve_static(int fd, char *filename, int filesize) {
 void request_handle(int fd) {
     int is_static;
     struct stat sbuf;
+    file_info_t info;
     char buf[MAXBUF], method[MAXBUF], uri[MAXBUF], version[MAXBUF];
     char filename[MAXBUF], cgiargs[MAXBUF];
+    char if_none_match[MAXBUF], if_modified_since[MAXBUF];
     
     readline_or_die(fd, buf, MAXBUF);
     sscanf(buf, "%s %s %s", method, uri, version);
@@ -156,20 +326,25 @@ void request_handle(int fd) {
 	request_error(fd, method, "501", "Not Implemented", "server does not implement this method");
 	return;
     }
-    request_read_headers(fd);
+    request_read_headers(fd, if_none_match, if_modified_since);
     
     is_static = request_parse_uri(uri, filename, cgiargs);
-    if (stat(filename, &sbuf) < 0) {
+    if (request_stat(filename, &info) < 0) {
 	request_error(fd, filename, "404", "Not found", "server could not find this file");
 	return;
     }
+    sbuf = info.sbuf;
     
     if (is_static) {
 	if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
 	    request_error(fd, filename, "403", "Forbidden", "server could not read this file");
 	    return;
 	}
-	request_serve_static(fd, filename, sbuf.st_size);
+	if (request_not_modified(&info, if_none_match, if_modified_since)) {
+	    request_serve_not_modified(fd, &info);
+	    return;
+	}
+	request_serve_static(fd, filename, &info);
     } else {
 	if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
 	    request_error(fd, filename, "403", "Forbidden", "server could not run this CGI program");
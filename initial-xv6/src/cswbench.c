@@ -0,0 +1,77 @@
+// Measure context-switch throughput: pairs of processes pass a byte
+// back and forth through two pipes, so every round trip blocks each
+// side once. Run under QEMU with CPUS=1 through CPUS=8 to see how the
+// scheduler scales; with more pairs than CPUs every CPU stays busy.
+//
+// usage: cswbench [pairs [rounds]]
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MAXPAIRS 16
+
+// pass a byte back and forth rounds times; the ping side starts
+static void
+pingpong(int in, int out, int rounds, int ping)
+{
+  char c = 0;
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    if(ping && write(out, &c, 1) != 1)
+      break;
+    if(read(in, &c, 1) != 1)
+      break;
+    if(!ping && write(out, &c, 1) != 1)
+      break;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pairs = 4, rounds = 2000;
+  int i, j, start, elapsed, switches;
+  int ab[2], ba[2];
+
+  if(argc > 1)
+    pairs = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(pairs < 1 || pairs > MAXPAIRS || rounds < 1){
+    printf(2, "usage: cswbench [pairs (1-%d) [rounds]]\n", MAXPAIRS);
+    exit();
+  }
+
+  start = uptime();
+  for(i = 0; i < pairs; i++){
+    if(pipe(ab) < 0 || pipe(ba) < 0){
+      printf(2, "cswbench: pipe failed\n");
+      exit();
+    }
+    for(j = 0; j < 2; j++){
+      if(fork() == 0){
+        if(j == 0)
+          pingpong(ba[0], ab[1], rounds, 1);
+        else
+          pingpong(ab[0], ba[1], rounds, 0);
+        exit();
+      }
+    }
+    close(ab[0]);
+    close(ab[1]);
+    close(ba[0]);
+    close(ba[1]);
+  }
+  for(i = 0; i < 2 * pairs; i++)
+    wait();
+  elapsed = uptime() - start;
+  if(elapsed < 1)
+    elapsed = 1;
+
+  // each round trip puts both sides to sleep once
+  switches = 2 * pairs * rounds;
+  printf(1, "%d pairs x %d rounds: %d switches in %d ticks, %d switches/tick\n",
+         pairs, rounds, switches, elapsed, switches / elapsed);
+  exit();
+}
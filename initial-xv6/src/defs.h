@@ -68,6 +68,10 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kref(char*);
+int             krefs(char*);
+char*           kallocbig(void);
+void            kfreebig(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -79,6 +83,8 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(uchar, int);
+void            lapictimer(int);
 void            microdelay(int);
 
 // log.c
@@ -107,6 +113,7 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             growprocbig(int);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -121,6 +128,12 @@ int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 
+// shm.c
+void            shminit(void);
+int             shmfork(struct proc*, struct proc*);
+void            shmdrop(struct proc*);
+int             shmcontains(struct proc*, uint, uint);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
@@ -151,6 +164,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -164,6 +178,8 @@ void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
+void            timerq_add(struct proc*);
+void            timerq_remove(struct proc*);
 
 // uart.c
 void            uartinit(void);
@@ -184,6 +200,10 @@ pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
+int             cowfault(pde_t*, uint);
+int             lazymap(struct proc*, uint, uint, int);
+int             mapshared(pde_t*, uint, char**, int);
+int             allocbiguvm(pde_t*, uint, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 
 // number of elements in fixed-size array
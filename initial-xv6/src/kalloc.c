@@ -23,15 +23,44 @@ struct {
   struct run *freelist;
 } kmem;
 
+// Whole 4 MiB frames, aligned, that kinit2() sets aside for
+// large user pages (see allocbiguvm).
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+} kbig;
+
+// References to each physical page, one per mapping in a page table
+// or other owner, so that a page shared copy-on-write after fork() is
+// freed by the last kfree(). Updated atomically, without a lock.
+static ushort refs[PHYSTOP / PGSIZE];
+
+#define KCACHE_BATCH 32  // pages moved between a CPU's cache and kmem at once
+
+// Free pages cached by each CPU, so that most calls of kalloc() and
+// kfree() take only their own CPU's lock, which is rarely contended.
+// A cache refills from kmem and drains back to it a batch at a time.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kcaches[NCPU];
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// Until then only kmem.freelist is used, without locks.
 void
 kinit1(void *vstart, void *vend)
 {
+  struct kcache *c;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&kbig.lock, "kbig");
+  for(c = kcaches; c < &kcaches[NCPU]; c++)
+    initlock(&c->lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -39,7 +68,13 @@ kinit1(void *vstart, void *vend)
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  char *p, *big;
+
+  // Keep the last NBIGPG 4 MiB frames whole.
+  big = (char*)vend - NBIGPG*BIGPGSIZE;
+  for(p = big; p + BIGPGSIZE <= (char*)vend; p += BIGPGSIZE)
+    kfreebig(p);
+  freerange(vstart, big);
   kmem.use_lock = 1;
 }
 
@@ -48,32 +83,78 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    refs[V2P(p) / PGSIZE] = 1;
     kfree(p);
+  }
 }
+
+// The cache of the current CPU. The caller may be moved to another
+// CPU once it has it; that only costs locality.
+static struct kcache*
+mycache(void)
+{
+  struct kcache *c;
+
+  pushcli();
+  c = &kcaches[cpuid()];
+  popcli();
+  return c;
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
+// Drop a reference to the page of physical memory pointed at by v,
+// and free it if that was the last one. The page normally should have
+// been returned by a call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  switch(__sync_sub_and_fetch(&refs[V2P(v) / PGSIZE], 1)){
+  case 0:
+    break;
+  case (ushort)-1:
+    panic("kfree: free page");
+  default:
+    return;
+  }
 
+#ifdef KFREE_JUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    return;
+  }
+
+  c = mycache();
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->n++;
+  if(c->n >= 2*KCACHE_BATCH){
+    // Give a batch back, keeping one for the next kalloc()s.
+    acquire(&kmem.lock);
+    for(i = 0; i < KCACHE_BATCH; i++){
+      r = c->freelist;
+      c->freelist = r->next;
+      r->next = kmem.freelist;
+      kmem.freelist = r;
+    }
+    c->n -= KCACHE_BATCH;
     release(&kmem.lock);
+  }
+  release(&c->lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +164,96 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c, *other;
+  int i;
+
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      refs[V2P(r) / PGSIZE] = 1;
+    }
+    return (char*)r;
+  }
 
-  if(kmem.use_lock)
+  c = mycache();
+  acquire(&c->lock);
+  if(c->freelist == 0){
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
+    for(i = 0; i < KCACHE_BATCH && kmem.freelist; i++){
+      r = kmem.freelist;
+      kmem.freelist = r->next;
+      r->next = c->freelist;
+      c->freelist = r;
+      c->n++;
+    }
     release(&kmem.lock);
+  }
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->n--;
+  }
+  release(&c->lock);
+
+  // kmem is empty too: take a page left in another CPU's cache.
+  // Only one cache lock is held at a time.
+  for(other = kcaches; r == 0 && other < &kcaches[NCPU]; other++){
+    if(other == c)
+      continue;
+    acquire(&other->lock);
+    r = other->freelist;
+    if(r){
+      other->freelist = r->next;
+      other->n--;
+    }
+    release(&other->lock);
+  }
+  if(r)
+    refs[V2P(r) / PGSIZE] = 1;
+  return (char*)r;
+}
+
+// Add a reference to the allocated page pointed at by v.
+void
+kref(char *v)
+{
+  __sync_fetch_and_add(&refs[V2P(v) / PGSIZE], 1);
+}
+
+// Return the number of references to the page pointed at by v.
+int
+krefs(char *v)
+{
+  return refs[V2P(v) / PGSIZE];
+}
+
+// Allocate one 4 MiB frame, aligned to its size.
+// Returns 0 if none is left.
+char*
+kallocbig(void)
+{
+  struct run *r;
+
+  acquire(&kbig.lock);
+  r = kbig.freelist;
+  if(r)
+    kbig.freelist = r->next;
+  release(&kbig.lock);
   return (char*)r;
 }
 
+// Free a frame returned by kallocbig().
+void
+kfreebig(char *v)
+{
+  struct run *r;
+
+  if((uint)v % BIGPGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kfreebig");
+  acquire(&kbig.lock);
+  r = (struct run*)v;
+  r->next = kbig.freelist;
+  kbig.freelist = r;
+  release(&kbig.lock);
+}
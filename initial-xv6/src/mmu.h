@@ -90,11 +90,19 @@ struct segdesc {
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define BIGPGSIZE       (1 << PDXSHIFT)  // bytes mapped by a PTE_PS directory entry
+#define BIGPGROUNDUP(sz) (((sz)+BIGPGSIZE-1) & ~(BIGPGSIZE-1))
+
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
 #define PTE_PS          0x080   // Page Size
+#define PTE_COW         0x200   // Copy-on-write (a bit left to software)
+
+// Page fault error code flags.
+#define FEC_PR          0x001   // Page was present: a protection fault
+#define FEC_WR          0x002   // Fault on a write
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
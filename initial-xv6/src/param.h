@@ -1,4 +1,6 @@
+#ifndef NPROC
 #define NPROC        64  // maximum number of processes
+#endif
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
@@ -7,8 +9,22 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXSEG        4  // program segments paged in on demand per process
+#ifndef NBIGPG
+#define NBIGPG        4  // 4 MiB frames set aside for large user pages
+#endif
+#define NSHM          8  // shared memory segments, SHMSIZE apart from SHMBASE
+#ifndef PIPESIZE
+#define PIPESIZE   4096  // bytes buffered in a pipe, a power of two up to a page
+#endif
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define SCHED_LOTTERY   0  // scheduling policies, see setsched()
+#define SCHED_STRIDE    1
+#ifndef SCHED_POLICY
+#define SCHED_POLICY SCHED_LOTTERY  // policy at boot
+#endif
+#define STRIDE1    (1<<20)  // stride of a process holding one ticket
 
@@ -8,11 +8,18 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#if PIPESIZE > PGSIZE
+#error "PIPESIZE must fit in a page"
+#endif
+// nread and nwrite run freely and wrap at 2^32, which keeps
+// them % PIPESIZE continuous only for a power of two.
+#if PIPESIZE & (PIPESIZE-1)
+#error "PIPESIZE must be a power of two"
+#endif
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // ring of PIPESIZE bytes, in a page of its own
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
@@ -30,6 +37,8 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if((p->data = kalloc()) == 0)
+    goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -47,8 +56,11 @@ pipealloc(struct file **f0, struct file **f1)
 
 //PAGEBREAK: 20
  bad:
-  if(p)
+  if(p){
+    if(p->data)
+      kfree(p->data);
     kfree((char*)p);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,30 +81,56 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    kfree(p->data);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
 //PAGEBREAK: 40
+// Copy n bytes in or out of the ring at position pos, in up
+// to two pieces if the bytes wrap around its end.
+static void
+ringcopy(struct pipe *p, uint pos, char *addr, int n, int in)
+{
+  int off, m;
+
+  off = pos % PIPESIZE;
+  m = n < PIPESIZE - off ? n : PIPESIZE - off;
+  if(in){
+    memmove(p->data + off, addr, m);
+    memmove(p->data, addr + m, n - m);
+  } else {
+    memmove(addr, p->data + off, m);
+    memmove(addr + m, p->data, n - m);
+  }
+}
+
+// Readers sleep only while the pipe is empty and writers only
+// while it is full, so wake the other side only when the pipe
+// stops being empty or full.
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += m){
     while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = p->nread + PIPESIZE - p->nwrite;
+    if(m > n - i)
+      m = n - i;
+    ringcopy(p, p->nwrite, addr + i, m, 1);
+    if(p->nwrite == p->nread)
+      wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
@@ -100,7 +138,7 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int m;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,12 +148,17 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  m = p->nwrite - p->nread;  //DOC: piperead-copy
+  if(m > n)
+    m = n;
+  if(m <= 0){
+    release(&p->lock);
+    return 0;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  ringcopy(p, p->nread, addr, m, 0);
+  if(p->nwrite == p->nread + PIPESIZE)
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  p->nread += m;
   release(&p->lock);
-  return i;
+  return m;
 }
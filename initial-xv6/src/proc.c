@@ -8,25 +8,333 @@
 #include "spinlock.h"
 #include "rand.h" // rand
 #include "pstat.h"
+#include "traps.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
 } ptable;
 
+// RUNNABLE processes, one run queue per CPU. Each queue keeps its
+// processes' tickets in a Fenwick tree indexed by slot of ptable.proc,
+// so the winner of a lottery is found in O(log NPROC) and only runnable
+// processes can win, and the same processes in a binary min-heap ordered
+// by pass, for the stride scheduler: the root is the next process to run.
+//
+// A CPU picks from its own queue holding only that queue's lock, so idle
+// CPUs never touch ptable.lock; when its queue is empty it steals from
+// the busiest one. Changes of state still need ptable.lock, and take the
+// queue lock inside it. Two queue locks are taken in index order.
+struct runq {
+  struct spinlock lock;
+  int tree[NPROC + 1];  // tree[i] sums the weights of slots (i - (i & -i), i]
+  int weight[NPROC];    // tickets counted for each slot, 0 unless queued
+  int total;
+  struct proc *heap[NPROC];
+  int n;
+  uint vtime;           // pass of the process scheduled last
+  unsigned long seed;   // state of the lottery draws
+  int picks;            // processes picked from this queue
+  int idle;             // times the CPU halted with nothing runnable
+};
+static struct runq runqs[NCPU];
+
+// SLEEPING processes in doubly-linked lists hashed by channel, so a
+// wakeup visits only the sleepers whose channel shares its bucket
+// instead of the whole process table. Protected by ptable.lock.
+#define SLEEPQBITS 6
+static struct proc *sleepq[1 << SLEEPQBITS];
+
+int schedpolicy = SCHED_POLICY;
 static struct proc *initproc;
 int nextpid = 1;
-int no_lottery_count = 0;
-int lottery_count = 0;
 extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
 
+// Add delta to the weight of slot i of the lottery tree of q.
+static void
+lottery_add(struct runq *q, int i, int delta)
+{
+  q->weight[i] += delta;
+  q->total += delta;
+  for(i++; i <= NPROC; i += i & -i)
+    q->tree[i] += delta;
+}
+
+// Return the slot holding ticket number winner, counting tickets in slot
+// order. 0 <= winner < q->total.
+static int
+lottery_find(struct runq *q, int winner)
+{
+  int pos = 0, step;
+
+  for(step = 1; step * 2 <= NPROC; step *= 2)
+    ;
+  for(; step > 0; step /= 2){
+    if(pos + step <= NPROC && q->tree[pos + step] <= winner){
+      pos += step;
+      winner -= q->tree[pos];
+    }
+  }
+  return pos;
+}
+
+// Passes wrap around; runnable passes stay within STRIDE1 of vtime,
+// so comparing their difference is safe.
+static int
+passless(struct proc *a, struct proc *b)
+{
+  return (int)(a->pass - b->pass) < 0;
+}
+
+static void
+heapset(struct runq *q, int i, struct proc *p)
+{
+  q->heap[i] = p;
+  p->heapidx = i;
+}
+
+// Move the process at heap position i up or down to its place.
+static void
+heapfix(struct runq *q, int i)
+{
+  struct proc *p = q->heap[i];
+  int child;
+
+  while(i > 0 && passless(p, q->heap[(i-1)/2])){
+    heapset(q, i, q->heap[(i-1)/2]);
+    i = (i-1)/2;
+  }
+  for(;;){
+    child = 2*i + 1;
+    if(child >= q->n)
+      break;
+    if(child+1 < q->n && passless(q->heap[child+1], q->heap[child]))
+      child++;
+    if(!passless(q->heap[child], p))
+      break;
+    heapset(q, i, q->heap[child]);
+    i = child;
+  }
+  heapset(q, i, p);
+}
+
+// Add p to q. A process coming back from sleep starts at the current
+// virtual time, so it cannot make up for lost time by monopolizing
+// the CPU. The queue lock must be held.
+static void
+runq_add(struct runq *q, struct proc *p)
+{
+  lottery_add(q, p - ptable.proc, p->tickets);
+  if((int)(p->pass - q->vtime) < 0)
+    p->pass = q->vtime;
+  heapset(q, q->n++, p);
+  heapfix(q, p->heapidx);
+  p->rq = q - runqs;
+}
+
+// The queue lock must be held. p->rq is left for the caller:
+// a thief moving p sets it to the new queue in runq_add, so that
+// runq_lock() never sees p in no queue while p is RUNNABLE.
+static void
+runq_remove(struct runq *q, struct proc *p)
+{
+  int i = p - ptable.proc;
+
+  lottery_add(q, i, -q->weight[i]);
+  i = p->heapidx;
+  q->n--;
+  if(i != q->n){
+    heapset(q, i, q->heap[q->n]);
+    heapfix(q, i);
+  }
+  p->heapidx = -1;
+}
+
+// Lock the run queue holding p, which may be moved by a thief
+// until its lock is held.
+static struct runq*
+runq_lock(struct proc *p)
+{
+  struct runq *q;
+  int rq;
+
+  for(;;){
+    rq = *(volatile int*)&p->rq;  // read once: a thief may change it
+    if(rq < 0 || rq >= ncpu)
+      panic("runq_lock");
+    q = &runqs[rq];
+    acquire(&q->lock);
+    if(p->rq == q - runqs)
+      return q;
+    release(&q->lock);
+  }
+}
+
+// Choose the next process of q: a lottery draw, or in stride
+// scheduling the smallest pass. Return 0 if q is empty.
+static struct proc*
+runq_pick(struct runq *q)
+{
+  struct proc *p = 0;
+
+  acquire(&q->lock);
+  if(q->total > 0){
+    q->picks += 1;
+    if(schedpolicy == SCHED_STRIDE)
+      p = q->heap[0];
+    else
+      p = &ptable.proc[lottery_find(q, rand_seeded(&q->seed, q->total))];
+  }
+  release(&q->lock);
+  return p;
+}
+
+// Move a process from the busiest other run queue to q and return it,
+// or 0 if no other queue has one waiting. Its pass keeps its lead over
+// its old queue's virtual time.
+static struct proc*
+runq_steal(struct runq *q)
+{
+  struct runq *victim = 0, *r, *first, *second;
+  struct proc *p = 0;
+
+  // Counts are read without locks; they only guide the choice.
+  for(r = runqs; r < &runqs[ncpu]; r++)
+    if(r != q && r->total > 0 && (victim == 0 || r->n > victim->n))
+      victim = r;
+  if(victim == 0)
+    return 0;
+
+  first = q < victim ? q : victim;
+  second = q < victim ? victim : q;
+  acquire(&first->lock);
+  acquire(&second->lock);
+  if(victim->total > 0){
+    p = victim->heap[0];
+    runq_remove(victim, p);
+    p->pass = p->pass - victim->vtime + q->vtime;
+    runq_add(q, p);
+  }
+  release(&second->lock);
+  release(&first->lock);
+  return p;
+}
+
+// Wake a halted CPU for the process just added to q: q's own CPU, or
+// else any idle one, which will steal it. release() of q's lock has
+// fenced the update of q against the reads of the idle flags here.
+static void
+kick(struct runq *q)
+{
+  struct cpu *c = &cpus[q - runqs];
+
+  if(!c->idle)
+    for(c = cpus; c < &cpus[ncpu] && !c->idle; c++)
+      ;
+  if(c < &cpus[ncpu] && c != mycpu())
+    lapicipi(c->apicid, T_IRQ0 + IRQ_WAKE);
+}
+
+// Halt this CPU until an interrupt, as nothing is runnable. All but
+// CPU 0, which keeps time, stop their clock meanwhile. Interrupts stay
+// off from setting the idle flag and looking at the run queues until
+// hlt, which sti delays by one instruction, so a kick cannot be lost.
+static void
+idle(struct cpu *c)
+{
+  struct runq *r;
+
+  cli();
+  c->idle = 1;
+  __sync_synchronize();
+  for(r = runqs; r < &runqs[ncpu]; r++)
+    if(r->total > 0)
+      break;
+  if(r == &runqs[ncpu]){
+    if(c != cpus)
+      lapictimer(0);
+    asm volatile("sti; hlt");
+    if(c != cpus)
+      lapictimer(1);
+  }
+  c->idle = 0;
+}
+
+// Return the sleep queue of chan; the multiplicative hash spreads
+// addresses that differ only in their low bits.
+static struct proc**
+sleepq_head(void *chan)
+{
+  return &sleepq[((uint)chan * 2654435761u) >> (32 - SLEEPQBITS)];
+}
+
+// Change the state of p, keeping the run queues in step: a process is
+// in a run queue exactly while it is RUNNABLE, and in the sleep queue of
+// p->chan exactly while it is SLEEPING. A process becoming
+// RUNNABLE joins the queue of the CPU it last ran on; one leaving it to
+// run is charged its stride. The time since the last change is charged
+// to p as run time or wait time. The ptable lock must be held.
+static void
+setstate(struct proc *p, enum procstate state)
+{
+  struct runq *q;
+  struct proc **head;
+  uint64 now = rdtsc();
+
+  if(!holding(&ptable.lock))
+    panic("setstate");
+  if(p->state == RUNNING)
+    p->runtime += now - p->stamp;
+  else if(p->state == RUNNABLE)
+    p->waittime += now - p->stamp;
+  p->stamp = now;
+  if(state == SLEEPING && p->state != SLEEPING){
+    head = sleepq_head(p->chan);
+    p->sprev = 0;
+    p->snext = *head;
+    if(*head)
+      (*head)->sprev = p;
+    *head = p;
+  } else if(state != SLEEPING && p->state == SLEEPING){
+    if(p->sprev)
+      p->sprev->snext = p->snext;
+    else
+      *sleepq_head(p->chan) = p->snext;
+    if(p->snext)
+      p->snext->sprev = p->sprev;
+  }
+  if(state == RUNNABLE && p->state != RUNNABLE){
+    q = &runqs[p->cpu];
+    acquire(&q->lock);
+    runq_add(q, p);
+    release(&q->lock);
+    kick(q);
+  } else if(state != RUNNABLE && p->state == RUNNABLE){
+    q = runq_lock(p);
+    runq_remove(q, p);
+    p->rq = -1;
+    if(state == RUNNING && schedpolicy == SCHED_STRIDE){
+      q->vtime = p->pass;
+      p->pass += p->stride;
+    }
+    release(&q->lock);
+  }
+  p->state = state;
+}
+
 void
 pinit(void)
 {
+  struct runq *q;
+
   initlock(&ptable.lock, "ptable");
+  for(q = runqs; q < &runqs[NCPU]; q++){
+    initlock(&q->lock, "runq");
+    q->seed = q - runqs + 1;
+  }
 }
 
 // Must be called with interrupts disabled
@@ -91,6 +399,14 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->rq = -1;
+  p->timeridx = -1;
+  p->exe = 0;
+  p->nseg = 0;
+  p->shm = 0;
+  p->ticks = 0;
+  p->runtime = p->waittime = 0;
+  p->nvcsw = p->nivcsw = 0;
 
   release(&ptable.lock);
 
@@ -130,7 +446,9 @@ userinit(void)
   
   initproc = p;
   initproc->tickets = 1;
-  initproc->ticks = 0;
+  initproc->stride = STRIDE1;
+  initproc->pass = 0;
+  initproc->cpu = 0;
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
@@ -153,7 +471,7 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setstate(p, RUNNABLE);
 
   release(&ptable.lock);
 }
@@ -164,21 +482,57 @@ int
 growproc(int n)
 {
   uint sz;
+  struct segment *s;
   struct proc *curproc = myproc();
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Just reserve the space; lazymap() maps each page
+    // when it is first used.
+    if(sz + n >= SHMBASE || sz + n < sz)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    // Forget program segments given up, so that memory grown
+    // over them again starts zeroed.
+    for(s = curproc->seg; s < &curproc->seg[curproc->nseg]; s++){
+      if(s->vaddr >= sz)
+        s->memsz = 0;
+      else if(s->vaddr + s->memsz > sz)
+        s->memsz = sz - s->vaddr;
+      if(s->filesz > s->memsz)
+        s->filesz = s->memsz;
+    }
   }
   curproc->sz = sz;
   switchuvm(curproc);
   return 0;
 }
 
+// Grow current process's memory by n bytes, rounded up to
+// 4 MiB pages, starting at the next 4 MiB boundary; the gap
+// below it joins the heap too. Return the start, or -1.
+int
+growprocbig(int n)
+{
+  uint start, end;
+  struct proc *curproc = myproc();
+
+  if(n <= 0)
+    return -1;
+  start = BIGPGROUNDUP(curproc->sz);
+  end = start + BIGPGROUNDUP((uint)n);
+  if(start < curproc->sz || end <= start || end >= SHMBASE)
+    return -1;
+  if(allocbiguvm(curproc->pgdir, start, end) == 0)
+    return -1;
+  curproc->sz = end;
+  switchuvm(curproc);
+  return start;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -201,9 +555,18 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+  if(shmfork(curproc, np) < 0){
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->sz = curproc->sz;
   np->tickets = curproc->tickets;
-  np->ticks = 0;
+  np->stride = curproc->stride;
+  np->pass = curproc->pass;
+  np->cpu = curproc->cpu;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -214,6 +577,10 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  if(curproc->exe)
+    np->exe = idup(curproc->exe);
+  memmove(np->seg, curproc->seg, sizeof(curproc->seg));
+  np->nseg = curproc->nseg;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -221,7 +588,7 @@ fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  setstate(np, RUNNABLE);
 
   release(&ptable.lock);
 
@@ -249,10 +616,16 @@ exit(void)
     }
   }
 
+  shmdrop(curproc);
+
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
+  curproc->nseg = 0;
 
   acquire(&ptable.lock);
 
@@ -269,7 +642,7 @@ exit(void)
   }
 
   // Jump into the scheduler, never to return.
-  curproc->state = ZOMBIE;
+  setstate(curproc, ZOMBIE);
   sched();
   panic("zombie exit");
 }
@@ -331,51 +704,42 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
-  int counter = 0; // track if we've found the winner yet.
+  struct runq *q = &runqs[c - cpus];
   c->proc = 0;
 
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    int total_tickets = 0;
-    int winner = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      total_tickets += p->tickets;
-    }
-    if (total_tickets > 0){
-      winner = rand(total_tickets);
-      lottery_count += 1;
-    }else{
-      no_lottery_count += 1;
+    // Pick a RUNNABLE process from this CPU's queue, or steal one.
+    // Another CPU may run it before we get ptable.lock: then it is
+    // no longer RUNNABLE and we pick again.
+    if((p = runq_pick(q)) == 0 && (p = runq_steal(q)) == 0){
+      q->idle += 1;
+      idle(c);
+      continue;
     }
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      counter = counter + p->tickets;
-      if(counter <= winner)
-        continue; // skip the loser
-      counter = 0; // reset count
-      p->ticks +=1;
-      if(p->state != RUNNABLE)
-        continue;
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
-      break; // run just one process for each lottery.
+    acquire(&ptable.lock);
+    if(p->state != RUNNABLE){
+      release(&ptable.lock);
+      continue;
     }
-    release(&ptable.lock);
 
+    // Switch to chosen process.  It is the process's job
+    // to release ptable.lock and then reacquire it
+    // before jumping back to us.
+    c->proc = p;
+    switchuvm(p);
+    setstate(p, RUNNING);
+    p->cpu = q - runqs;
+
+    swtch(&(c->scheduler), p->context);
+    switchkvm();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&ptable.lock);
   }
 }
 
@@ -406,11 +770,16 @@ sched(void)
 }
 
 // Give up the CPU for one scheduling round.
+// Called on every clock tick, which is charged to the process.
 void
 yield(void)
 {
+  struct proc *p = myproc();
+
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  p->ticks += 1;
+  p->nivcsw += 1;
+  setstate(p, RUNNABLE);
   sched();
   release(&ptable.lock);
 }
@@ -461,7 +830,8 @@ sleep(void *chan, struct spinlock *lk)
   }
   // Go to sleep.
   p->chan = chan;
-  p->state = SLEEPING;
+  p->nvcsw += 1;
+  setstate(p, SLEEPING);
 
   sched();
 
@@ -481,11 +851,13 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for(p = *sleepq_head(chan); p; p = next){
+    next = p->snext;  // setstate() unlinks p
+    if(p->chan == chan)
+      setstate(p, RUNNABLE);
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -511,7 +883,7 @@ kill(int pid)
       p->killed = 1;
       // Wake process from sleep if necessary.
       if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+        setstate(p, RUNNABLE);
       release(&ptable.lock);
       return 0;
     }
@@ -555,8 +927,9 @@ procdump(void)
     }
     cprintf("\n");
   }
-  cprintf("lottery count: %d\n", lottery_count);
-  cprintf("no lottery count: %d\n", no_lottery_count);
+  for(i = 0; i < ncpu; i++)
+    cprintf("cpu %d: %d queued, %d picks, %d idle rounds\n",
+            i, runqs[i].n, runqs[i].picks, runqs[i].idle);
 }
 
 // set the tickets held by current process
@@ -571,33 +944,63 @@ sys_settickets()
   struct proc *curproc = myproc();
  
   curproc->tickets = n;
+  curproc->stride = STRIDE1 / n;
 
   return 0;
 }  
 
-// get all process info
+// select the scheduling policy, SCHED_LOTTERY or SCHED_STRIDE;
+// return the previous one
+int
+sys_setsched()
+{
+  int policy, old;
+  if(argint(0, &policy) < 0) return -1;
+
+  if (policy != SCHED_LOTTERY && policy != SCHED_STRIDE) return -1;
+
+  acquire(&ptable.lock);
+  old = schedpolicy;
+  schedpolicy = policy;
+  release(&ptable.lock);
+  return old;
+}
+
+// get all process info, copied under the ptable lock so that the
+// counters of all processes are taken at the same instant
 int
 sys_getpinfo()
 {
   char * p;
-  if(argptr(0, &p, sizeof(struct pstat)) < 0)
+  if(argwptr(0, &p, sizeof(struct pstat)) < 0)
     return -1;
   struct pstat * s = (struct pstat *)p;
 
-  for(int i=0; i<NPROC; i++){
-    s->inuse[i] = 0;
-    s->tickets[i] = 0;
-    s->ticks[i] = 0;
-    s->pid[i] = 0;
-  }
+  acquire(&ptable.lock);
+  uint64 now = rdtsc();
   int i=0;
   for(struct proc * p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    s->inuse[i] = (p->state == RUNNING);
+    uint64 runtime = p->runtime, waittime = p->waittime;
+    // the current stretch is charged only at the next change of state
+    if(p->state == RUNNING)
+      runtime += now - p->stamp;
+    else if(p->state == RUNNABLE)
+      waittime += now - p->stamp;
+
+    s->inuse[i] = (p->state != UNUSED);
     s->tickets[i] = p->tickets;
     s->ticks[i] = p->ticks;
+    s->stride[i] = p->stride;
+    s->pass[i] = p->pass;
     s->pid[i] = p->pid;
+    s->runtime[i] = runtime >> 10;
+    s->waittime[i] = waittime >> 10;
+    s->nvcsw[i] = p->nvcsw;
+    s->nivcsw[i] = p->nivcsw;
+    s->lastcpu[i] = p->cpu;
 
     i++;
   }
+  release(&ptable.lock);
   return 0;
 }
@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile int idle;           // Halted, waiting for a process to run
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,6 +35,15 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A program segment whose pages exec() left to be read
+// from the program file when first touched.
+struct segment {
+  uint vaddr;                  // Page aligned start
+  uint memsz;                  // Bytes in memory
+  uint filesz;                 // Bytes from the file; the rest are zero
+  uint off;                    // Offset of the segment in the file
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -45,12 +55,29 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *snext, *sprev;  // Neighbours in the sleep queue of chan
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct inode *exe;           // Program file, for segments not read in
+  struct segment seg[MAXSEG];  // Program segments paged in on demand
+  int nseg;
+  uint shm;                    // bit i set while shared segment i is attached
   int tickets;                 // tickets used in lottery scheduler
-  int ticks;
+  uint stride;                 // STRIDE1 / tickets, pass advance per quantum
+  uint pass;                   // next time to run, in stride scheduling
+  int heapidx;                 // position in the stride heap while RUNNABLE
+  int rq;                      // run queue holding p while RUNNABLE, or -1
+  int cpu;                     // CPU p last ran on; its queue takes p when woken
+  int ticks;                   // clock ticks taken while RUNNING
+  uint64 stamp;                // rdtsc() at the last change of state
+  uint64 runtime;              // cycles spent RUNNING
+  uint64 waittime;             // cycles spent RUNNABLE
+  int nvcsw;                   // switches out to sleep
+  int nivcsw;                  // switches out at a clock tick
+  uint deadline;               // tick to wake up at, in sys_sleep
+  int timeridx;                // position in the timer queue, or -1
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -5,14 +5,15 @@
 int
 main(int argc, char *argv[])
 {
-  struct pstat p;
+  static struct pstat p; // too large for the stack when NPROC is raised
   printf(1, "Process Statistics\n");
   getpinfo(&p);
-  printf(1, "inuse tickets pid ticks\n");
+  printf(1, "inuse tickets pid ticks runtime waittime vcsw ivcsw cpu\n");
   for(int i=0; i<NPROC; i++){
     if (p.pid[i] != 0){
-      printf(1,"%d %d %d %d\n",
-              p.inuse[i], p.tickets[i], p.pid[i], p.ticks[i]);
+      printf(1,"%d %d %d %d %d %d %d %d %d\n",
+              p.inuse[i], p.tickets[i], p.pid[i], p.ticks[i],
+              p.runtime[i], p.waittime[i], p.nvcsw[i], p.nivcsw[i], p.lastcpu[i]);
     }
   }
 
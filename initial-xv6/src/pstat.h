@@ -3,11 +3,20 @@
 
 #include "param.h"
 
+// A snapshot of the process table, all taken at one instant.
+// Times are in units of 1024 time-stamp counter cycles.
 struct pstat {
   int inuse[NPROC];   // whether this slot of the process table is in use (1 or 0)
   int tickets[NPROC]; // the number of tickets this process has
   int pid[NPROC];     // the PID of each process 
-  int ticks[NPROC];   // the number of ticks each process has accumulated 
+  int ticks[NPROC];   // the number of clock ticks each process ran through
+  int stride[NPROC];  // STRIDE1 / tickets
+  int pass[NPROC];    // virtual time of the stride scheduler
+  uint runtime[NPROC];  // time spent running
+  uint waittime[NPROC]; // time spent runnable, waiting for a CPU
+  int nvcsw[NPROC];   // times the process gave up the CPU to sleep
+  int nivcsw[NPROC];  // times the process was preempted by the clock
+  int lastcpu[NPROC]; // the CPU the process ran on last
 };
 
 #endif // _PSTAT_H_
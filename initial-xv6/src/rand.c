@@ -2,10 +2,15 @@
 // https://stackoverflow.com/questions/24005459/implementation-of-the-random-number-generator-in-c-c
 
 static unsigned long int next = 1; 
+int rand_seeded(unsigned long int *seed, int max) // rand() with the caller's state
+{
+  *seed = *seed * 1103515245 + 12345;
+  return (unsigned int)(*seed/65536) % max;
+}
+
 int rand(int max) // return 0 .. max - 1
 {
-  next = next * 1103515245 + 12345;
-  return (unsigned int)(next/65536) % max;
+  return rand_seeded(&next, max);
 } 
 
 void srand(unsigned int seed) 
@@ -1,2 +1,3 @@
 int rand(int max); // generate random number between 0 and max, excluding max.
+int rand_seeded(unsigned long int *seed, int max); // rand() drawing from *seed, for callers that each keep their own state.
 void srand(unsigned int seed) ; // change the seed from 1 to seed.
@@ -0,0 +1,87 @@
+// Compare how closely lottery and stride scheduling give CPU-bound
+// processes their share of tickets over short windows.
+//
+// For each policy, NCHILD spinning children hold 1:2:3 tickets. Every
+// WINDOW ticks the parent reads the ticks each child received and adds
+// up how far each child's share is from its ticket share. The mean error
+// is printed in tenths of a percent; stride should be far below lottery.
+// Run it with CPUS=1 so shares are not blurred across CPUs.
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "pstat.h"
+
+#define NCHILD 3
+#define WINDOW 10   // ticks between samples
+#define SAMPLES 20
+
+static int tickets[NCHILD] = { 100, 200, 300 };
+
+// ticks received by process pid, or -1
+static int
+ticksof(struct pstat *s, int pid)
+{
+  int i;
+
+  for(i = 0; i < NPROC; i++)
+    if(s->pid[i] == pid)
+      return s->ticks[i];
+  return -1;
+}
+
+// mean error of the children's shares, in tenths of a percent
+static int
+measure(int policy)
+{
+  static struct pstat before, after;
+  int pids[NCHILD];
+  int i, n, total, alltickets, share, error;
+
+  setsched(policy);
+  alltickets = 0;
+  for(i = 0; i < NCHILD; i++){
+    alltickets += tickets[i];
+    pids[i] = fork();
+    if(pids[i] == 0){
+      settickets(tickets[i]);
+      for(;;)
+        ;
+    }
+  }
+  sleep(WINDOW); // let the children set their tickets
+  getpinfo(&before);
+  error = 0;
+  for(n = 0; n < SAMPLES; n++){
+    sleep(WINDOW);
+    getpinfo(&after);
+    total = 0;
+    for(i = 0; i < NCHILD; i++)
+      total += ticksof(&after, pids[i]) - ticksof(&before, pids[i]);
+    for(i = 0; total > 0 && i < NCHILD; i++){
+      share = (ticksof(&after, pids[i]) - ticksof(&before, pids[i])) * 1000 / total;
+      share -= tickets[i] * 1000 / alltickets;
+      error += share < 0 ? -share : share;
+    }
+    memmove(&before, &after, sizeof(before));
+  }
+  for(i = 0; i < NCHILD; i++){
+    kill(pids[i]);
+    wait();
+  }
+  return error / (SAMPLES * NCHILD);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int old;
+
+  settickets(10000); // wake up on time to take samples
+  old = setsched(SCHED_LOTTERY);
+  printf(1, "lottery: mean share error %d/1000 per %d-tick window\n",
+         measure(SCHED_LOTTERY), WINDOW);
+  printf(1, "stride: mean share error %d/1000 per %d-tick window\n",
+         measure(SCHED_STRIDE), WINDOW);
+  setsched(old);
+  exit();
+}
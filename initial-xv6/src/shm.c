@@ -0,0 +1,201 @@
+// Shared memory: segments of physical pages that several processes
+// map at once, so they can pass bulk data without the kernel
+// copying it through a pipe.
+//
+// shmget(key, size) attaches the segment named key, creating it
+// if need be, and returns its address. Segment i is always mapped
+// at SHMBASE + i*SHMSIZE, above the space the process can grow
+// into. Every mapping holds a reference to each page (see kref),
+// and the segment holds one more while any process has it attached,
+// so a page is freed only when the last of them lets go.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg {
+  int key;
+  int npages;                     // 0 if the slot is free
+  int nattach;                    // processes that have it attached
+  char *pages[SHMSIZE / PGSIZE];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shm;
+
+void
+shminit(void)
+{
+  if(NSHM*SHMSIZE > KERNBASE - SHMBASE)
+    panic("shminit");
+  initlock(&shm.lock, "shm");
+}
+
+// Free the pages of a segment nobody has attached.
+static void
+shmfree(struct shmseg *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pages[i]);
+  s->npages = 0;
+  s->key = 0;
+}
+
+// Map segment i into p. Caller holds shm.lock.
+static int
+shmmap(struct proc *p, int i)
+{
+  struct shmseg *s = &shm.seg[i];
+
+  if(mapshared(p->pgdir, SHMBASE + i*SHMSIZE, s->pages, s->npages) < 0)
+    return -1;
+  s->nattach++;
+  p->shm |= 1 << i;
+  return 0;
+}
+
+// Unmap segment i from p, and free it if p was the last
+// process to have it. Caller holds shm.lock.
+static void
+shmunmap(struct proc *p, int i)
+{
+  struct shmseg *s = &shm.seg[i];
+  uint va = SHMBASE + i*SHMSIZE;
+
+  deallocuvm(p->pgdir, va + SHMSIZE, va);
+  if(p == myproc())
+    lcr3(V2P(p->pgdir));  // flush the TLB
+  p->shm &= ~(1 << i);
+  if(--s->nattach == 0)
+    shmfree(s);
+}
+
+// Attach to child every segment parent has attached.
+// Return 0, or -1 with none attached.
+int
+shmfork(struct proc *parent, struct proc *child)
+{
+  int i;
+
+  acquire(&shm.lock);
+  for(i = 0; i < NSHM; i++){
+    if((parent->shm & (1 << i)) && shmmap(child, i) < 0){
+      release(&shm.lock);
+      shmdrop(child);
+      return -1;
+    }
+  }
+  release(&shm.lock);
+  return 0;
+}
+
+// Detach every segment p has attached, in exit and exec.
+void
+shmdrop(struct proc *p)
+{
+  int i;
+
+  acquire(&shm.lock);
+  for(i = 0; i < NSHM; i++)
+    if(p->shm & (1 << i))
+      shmunmap(p, i);
+  release(&shm.lock);
+}
+
+// Whether [va, va+len) lies in a segment p has attached,
+// for system call arguments there.
+int
+shmcontains(struct proc *p, uint va, uint len)
+{
+  uint i;
+
+  if(va < SHMBASE)
+    return 0;
+  i = (va - SHMBASE) / SHMSIZE;
+  if(i >= NSHM || !(p->shm & (1 << i)))
+    return 0;
+  return va + len >= va &&
+         va + len <= SHMBASE + i*SHMSIZE + shm.seg[i].npages*PGSIZE;
+}
+
+int
+sys_shmget(void)
+{
+  int key, size, i, n, slot;
+  struct shmseg *s;
+  struct proc *p = myproc();
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  if(size < 0 || size > SHMSIZE)
+    return -1;
+
+  acquire(&shm.lock);
+  slot = -1;
+  for(i = 0; i < NSHM; i++){
+    if(shm.seg[i].npages > 0 && shm.seg[i].key == key)
+      break;
+    if(shm.seg[i].npages == 0 && slot < 0)
+      slot = i;
+  }
+  if(i == NSHM){
+    // Create it, zeroed.
+    if(slot < 0 || size == 0)
+      goto bad;
+    i = slot;
+    s = &shm.seg[i];
+    for(n = 0; n < PGROUNDUP(size) / PGSIZE; n++){
+      if((s->pages[n] = kalloc()) == 0){
+        s->npages = n;
+        shmfree(s);
+        goto bad;
+      }
+      memset(s->pages[n], 0, PGSIZE);
+    }
+    s->npages = n;
+    s->key = key;
+  }
+  s = &shm.seg[i];
+  if(size > s->npages * PGSIZE)
+    goto bad;
+  if(!(p->shm & (1 << i)) && shmmap(p, i) < 0){
+    if(s->nattach == 0)
+      shmfree(s);
+    goto bad;
+  }
+  release(&shm.lock);
+  return SHMBASE + i*SHMSIZE;
+
+bad:
+  release(&shm.lock);
+  return -1;
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+  uint i;
+  struct proc *p = myproc();
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  if((uint)addr < SHMBASE)
+    return -1;
+  i = ((uint)addr - SHMBASE) / SHMSIZE;
+  if(i >= NSHM || (uint)addr != SHMBASE + i*SHMSIZE || !(p->shm & (1 << i)))
+    return -1;
+  acquire(&shm.lock);
+  shmunmap(p, i);
+  release(&shm.lock);
+  return 0;
+}
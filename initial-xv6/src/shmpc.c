@@ -0,0 +1,165 @@
+// Pass bulk data from a producer to a consumer process, first
+// through a ring in shared memory and then through a pipe, and
+// compare: the ring moves the bytes with no system calls and no
+// copies in the kernel. Both sides spin on the ring, so run it
+// with CPUS=2 or more.
+//
+// usage: shmpc [kbytes]
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define KEY 0x7063
+#define CHUNK 4096
+#define RINGSIZE (16*CHUNK)
+
+struct ring {
+  volatile uint head;  // bytes written; only the producer moves it
+  volatile uint tail;  // bytes read; only the consumer moves it
+  char buf[RINGSIZE];
+};
+
+static char chunk[CHUNK];
+
+// fill chunk with the bytes expected at offset off
+static void
+fill(uint off)
+{
+  int i;
+
+  for(i = 0; i < CHUNK; i++)
+    chunk[i] = (off + i) % 251;
+}
+
+// whether p holds the bytes expected at offset off
+static int
+check(char *p, uint off)
+{
+  int i;
+
+  for(i = 0; i < CHUNK; i++)
+    if(p[i] != (char)((off + i) % 251))
+      return 0;
+  return 1;
+}
+
+static void
+produce(struct ring *r, uint total)
+{
+  uint off;
+
+  for(off = 0; off < total; off += CHUNK){
+    fill(off);
+    while(r->head - r->tail == RINGSIZE)
+      ;
+    memmove(r->buf + r->head % RINGSIZE, chunk, CHUNK);
+    __sync_synchronize();  // data before head
+    r->head += CHUNK;
+  }
+}
+
+static void
+consume(struct ring *r, uint total)
+{
+  uint off;
+
+  for(off = 0; off < total; off += CHUNK){
+    while(r->head == r->tail)
+      ;
+    __sync_synchronize();  // head before data
+    if(!check(r->buf + r->tail % RINGSIZE, off)){
+      printf(2, "shmpc: bad data at %d\n", off);
+      return;
+    }
+    r->tail += CHUNK;
+  }
+}
+
+static void
+pipeproduce(int fd, uint total)
+{
+  uint off;
+
+  for(off = 0; off < total; off += CHUNK){
+    fill(off);
+    if(write(fd, chunk, CHUNK) != CHUNK)
+      return;
+  }
+}
+
+static void
+pipeconsume(int fd, uint total)
+{
+  static char buf[CHUNK];
+  uint off;
+  int n, m;
+
+  for(off = 0; off < total; off += CHUNK){
+    for(n = 0; n < CHUNK; n += m)
+      if((m = read(fd, buf + n, CHUNK - n)) <= 0)
+        return;
+    if(!check(buf, off)){
+      printf(2, "shmpc: bad data at %d\n", off);
+      return;
+    }
+  }
+}
+
+static void
+report(char *how, uint total, int ticks)
+{
+  if(ticks < 1)
+    ticks = 1;
+  printf(1, "%s: %d KB in %d ticks, %d KB/tick\n",
+         how, total / 1024, ticks, total / 1024 / ticks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct ring *r;
+  uint total;
+  int start, fds[2];
+
+  total = 4096 * 1024;
+  if(argc > 1)
+    total = atoi(argv[1]) * 1024;
+  total -= total % CHUNK;
+  if(total == 0){
+    printf(2, "usage: shmpc [kbytes]\n");
+    exit();
+  }
+
+  r = shmget(KEY, sizeof(*r));
+  if(r == (struct ring*)-1){
+    printf(2, "shmpc: shmget failed\n");
+    exit();
+  }
+  r->head = r->tail = 0;
+  start = uptime();
+  if(fork() == 0){
+    consume(r, total);
+    exit();
+  }
+  produce(r, total);
+  wait();
+  report("shared memory", total, uptime() - start);
+  shmdt(r);
+
+  if(pipe(fds) < 0){
+    printf(2, "shmpc: pipe failed\n");
+    exit();
+  }
+  start = uptime();
+  if(fork() == 0){
+    close(fds[1]);
+    pipeconsume(fds[0], total);
+    exit();
+  }
+  close(fds[0]);
+  pipeproduce(fds[1], total);
+  close(fds[1]);
+  wait();
+  report("pipe", total, uptime() - start);
+  exit();
+}
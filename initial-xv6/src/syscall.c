@@ -14,12 +14,14 @@
 // to a saved program counter, and then the first argument.
 
 // Fetch the int at addr from the current process.
+// Pages not mapped yet are mapped first (see lazymap),
+// here and in the functions below.
 int
 fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(lazymap(curproc, addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -39,6 +41,9 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       lazymap(curproc, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -54,25 +59,49 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+// lies within the process address space.  If the system call
+// will write the block, its copy-on-write pages are copied now,
+// before any lock is taken, so the kernel never faults on them.
+static int
+argbuf(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0)
+    return -1;
+  if(shmcontains(curproc, i, size)){
+    *pp = (char*)i;
+    return 0;
+  }
+  if((uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+    return -1;
+  if(lazymap(curproc, i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// A block the system call only reads.
+int
+argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 0);
+}
+
+// A block the system call writes.
+int
+argwptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Strings are never taken from shared memory, so the string can't
+// change between this check and being used by the kernel.)
 int
 argstr(int n, char **pp)
 {
@@ -106,6 +135,10 @@ extern int sys_uptime(void);
 extern int sys_getreadcount(void);
 extern int sys_settickets(void);
 extern int sys_getpinfo(void);
+extern int sys_setsched(void);
+extern int sys_sbrklarge(void);
+extern int sys_shmget(void);
+extern int sys_shmdt(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -132,6 +165,10 @@ static int (*syscalls[])(void) = {
 [SYS_getreadcount] sys_getreadcount,
 [SYS_settickets] sys_settickets,
 [SYS_getpinfo] sys_getpinfo,
+[SYS_setsched] sys_setsched,
+[SYS_sbrklarge] sys_sbrklarge,
+[SYS_shmget]  sys_shmget,
+[SYS_shmdt]   sys_shmdt,
 };
 
 void
@@ -23,3 +23,7 @@
 #define SYS_getreadcount  22
 #define SYS_settickets 23
 #define SYS_getpinfo 24
+#define SYS_setsched 25
+#define SYS_sbrklarge 26
+#define SYS_shmget 27
+#define SYS_shmdt  28
@@ -56,22 +56,37 @@ sys_sbrk(void)
   return addr;
 }
 
+// Like sbrk, but in 4 MiB pages from the next 4 MiB
+// boundary; returns the start of the new memory.
+int
+sys_sbrklarge(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return growprocbig(n);
+}
+
 int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+  struct proc *p = myproc();
 
   if(argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
+  p->deadline = ticks + n;
+  if(n > 0)
+    timerq_add(p);
+  while((int)(p->deadline - ticks) > 0){
+    if(p->killed){
+      timerq_remove(p);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&p->deadline, &tickslock);
   }
   release(&tickslock);
   return 0;
@@ -0,0 +1,51 @@
+// Show what 4 MiB pages save in TLB misses: stride through a
+// 16 MiB array one 4 KiB page per access, so that each access
+// needs its own TLB entry with small pages, first in memory
+// from sbrk() and then from sbrklarge().
+//
+// usage: tlbbench [passes]
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define SIZE (16*1024*1024)
+#define STRIDE 4096
+
+// ticks taken by passes strides through a
+static int
+stride(volatile char *a, int passes)
+{
+  int i, pass, start;
+
+  for(i = 0; i < SIZE; i += STRIDE)  // map every page first
+    a[i] = 1;
+  start = uptime();
+  for(pass = 0; pass < passes; pass++)
+    for(i = 0; i < SIZE; i += STRIDE)
+      a[i]++;
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int passes = 2000;
+  char *small, *large;
+
+  if(argc > 1)
+    passes = atoi(argv[1]);
+
+  if((small = sbrk(SIZE)) == (char*)-1){
+    printf(2, "tlbbench: sbrk failed\n");
+    exit();
+  }
+  printf(1, "4 KiB pages: %d ticks\n", stride(small, passes));
+  sbrk(-SIZE);
+
+  if((large = sbrklarge(SIZE)) == (char*)-1){
+    printf(2, "tlbbench: sbrklarge failed\n");
+    exit();
+  }
+  printf(1, "4 MiB pages: %d ticks\n", stride(large, passes));
+  exit();
+}
@@ -14,6 +14,92 @@ extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
 
+// Processes in sys_sleep, in a binary min-heap ordered by deadline, so
+// a tick wakes only the processes whose deadline has come.
+// Protected by tickslock.
+struct {
+  struct proc *heap[NPROC];
+  int n;
+} timerq;
+
+// Deadlines wrap around like ticks; compare their difference.
+static int
+deadlineless(struct proc *a, struct proc *b)
+{
+  return (int)(a->deadline - b->deadline) < 0;
+}
+
+static void
+timerset(int i, struct proc *p)
+{
+  timerq.heap[i] = p;
+  p->timeridx = i;
+}
+
+// Move the process at heap position i up or down to its place.
+static void
+timerfix(int i)
+{
+  struct proc *p = timerq.heap[i];
+  int child;
+
+  while(i > 0 && deadlineless(p, timerq.heap[(i-1)/2])){
+    timerset(i, timerq.heap[(i-1)/2]);
+    i = (i-1)/2;
+  }
+  for(;;){
+    child = 2*i + 1;
+    if(child >= timerq.n)
+      break;
+    if(child+1 < timerq.n && deadlineless(timerq.heap[child+1], timerq.heap[child]))
+      child++;
+    if(!deadlineless(timerq.heap[child], p))
+      break;
+    timerset(i, timerq.heap[child]);
+    i = child;
+  }
+  timerset(i, p);
+}
+
+// Queue p to be woken, on chan &p->deadline, once ticks reaches
+// p->deadline. tickslock must be held.
+void
+timerq_add(struct proc *p)
+{
+  timerset(timerq.n++, p);
+  timerfix(p->timeridx);
+}
+
+// Take p off the timer queue, if it is still there.
+// tickslock must be held.
+void
+timerq_remove(struct proc *p)
+{
+  int i = p->timeridx;
+
+  if(i < 0)
+    return;
+  timerq.n--;
+  if(i != timerq.n){
+    timerset(i, timerq.heap[timerq.n]);
+    timerfix(i);
+  }
+  p->timeridx = -1;
+}
+
+// Wake the processes whose deadline has come.
+static void
+timerq_expire(void)
+{
+  struct proc *p;
+
+  while(timerq.n > 0 && (int)(ticks - timerq.heap[0]->deadline) >= 0){
+    p = timerq.heap[0];
+    timerq_remove(p);
+    wakeup(&p->deadline);
+  }
+}
+
 void
 tvinit(void)
 {
@@ -51,11 +137,15 @@ trap(struct trapframe *tf)
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
+      timerq_expire();
       release(&tickslock);
     }
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKE:
+    // Only brings a halted CPU back to its scheduler.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -78,6 +168,21 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A write by user code to a copy-on-write page gets a
+    // private copy. System calls copy such pages before they
+    // write to them (see argwptr and copyout), so that running
+    // out of memory fails the call instead of panicking here.
+    if(myproc() && (tf->err & FEC_WR) &&
+       cowfault(myproc()->pgdir, rcr2()) == 0)
+      break;
+    // A touch of a page not mapped yet reads it in from the
+    // program file, or gets a zeroed page of heap.
+    if(myproc() && !(tf->err & FEC_PR) &&
+       lazymap(myproc(), rcr2(), 1, 0) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
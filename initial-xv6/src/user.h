@@ -27,6 +27,10 @@ int uptime(void);
 int getreadcount(void);
 int settickets(int number);
 int getpinfo(struct pstat *);
+int setsched(int policy);
+char* sbrklarge(int);
+void* shmget(int key, int size);
+int shmdt(void*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -31,7 +31,9 @@ seginit(void)
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. If va lies in
+// a 4 MiB page, return its page directory entry, which
+// has PTE_PS set.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,6 +41,8 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return pde;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
@@ -87,8 +91,10 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //
 // setupkvm() and exec() set up every page table like this:
 //
-//   0..KERNBASE: user memory (text+data+stack+heap), mapped to
+//   0..SHMBASE: user memory (text+data+stack+heap), mapped to
 //                phys memory allocated by the kernel
+//   SHMBASE..KERNBASE: shared memory segments the process has
+//                attached (see shm.c)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
@@ -114,6 +120,37 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+// Map size bytes at va to physical addresses starting at
+// pa, like mappages, but with 4 MiB pages wherever va and
+// pa are both aligned to them: the kernel's mappings then
+// need a few TLB entries and page table pages instead of
+// thousands. va, pa and size must be page-aligned.
+static int
+mapkernel(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if(va % BIGPGSIZE == 0 && pa % BIGPGSIZE == 0 && size >= BIGPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = BIGPGSIZE;
+    } else {
+      // up to the next 4 MiB boundary
+      n = BIGPGSIZE - va % BIGPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, (void*)va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
 pde_t*
 setupkvm(void)
@@ -127,8 +164,8 @@ setupkvm(void)
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+    if(mapkernel(pgdir, (uint)k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0) {
       freevm(pgdir);
       return 0;
     }
@@ -224,7 +261,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz >= SHMBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -248,6 +285,55 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Map zeroed 4 MiB pages over oldsz to newsz, both aligned
+// to 4 MiB, for a heap that asked for large pages: a program
+// striding through it then takes one TLB entry per 4 MiB.
+// Returns newsz, or 0 if the large frames have run out.
+int
+allocbiguvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  char *mem;
+  pde_t *pde;
+  uint a;
+
+  if(newsz >= SHMBASE || oldsz % BIGPGSIZE || newsz % BIGPGSIZE)
+    return 0;
+  for(a = oldsz; a < newsz; a += BIGPGSIZE){
+    pde = &pgdir[PDX(a)];
+    if(*pde & PTE_PS)
+      panic("remap");
+    if((mem = kallocbig()) == 0){
+      deallocuvm(pgdir, newsz, oldsz);
+      return 0;
+    }
+    memset(mem, 0, BIGPGSIZE);
+    // Nothing is mapped above the process size, but
+    // deallocuvm() leaves the page table pages in place.
+    if(*pde & PTE_P)
+      kfree(P2V(PTE_ADDR(*pde)));
+    *pde = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+  }
+  return newsz;
+}
+
+// Map the n pages at va for memory shared with other processes;
+// each mapping holds a reference to its page.
+// Return 0, or -1 with nothing mapped.
+int
+mapshared(pde_t *pgdir, uint va, char **pages, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(mappages(pgdir, (char*)va + i*PGSIZE, PGSIZE, V2P(pages[i]), PTE_W|PTE_U) < 0){
+      deallocuvm(pgdir, va + i*PGSIZE, va);
+      return -1;
+    }
+    kref(pages[i]);
+  }
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -266,7 +352,18 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
+    else if(*pte & PTE_PS){
+      // A 4 MiB page goes once no byte of it is kept. The
+      // released tail of one still partly in use is zeroed, so
+      // that growing over it again finds zeroed memory.
+      if(a % BIGPGSIZE == 0){
+        kfreebig(P2V(PTE_ADDR(*pte)));
+        *pte = 0;
+      } else
+        memset((char*)P2V(PTE_ADDR(*pte)) + a % BIGPGSIZE, 0,
+               BIGPGSIZE - a % BIGPGSIZE);
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    } else if((*pte & PTE_P) != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
@@ -289,7 +386,7 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -311,7 +408,10 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The pages are shared, not copied:
+// writable ones become read-only and PTE_COW in both
+// tables, and the first write to one copies it (see
+// cowfault). pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
@@ -323,19 +423,29 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // Heap that sbrk() reserved but was never touched
+    // is left unmapped in the child too.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if(*pte & PTE_PS){
+      // 4 MiB pages are copied: they come from a small pool,
+      // and a write fault would have to copy all of one.
+      if((mem = kallocbig()) == 0)
+        goto bad;
+      memmove(mem, (char*)P2V(PTE_ADDR(*pte)), BIGPGSIZE);
+      d[PDX(i)] = V2P(mem) | PTE_FLAGS(*pte);
+      i += BIGPGSIZE - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_W){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      invlpg((void*)i);
+    }
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
+    kref(P2V(pa));
   }
   return d;
 
@@ -344,6 +454,106 @@ bad:
   return 0;
 }
 
+// Handle a write to the copy-on-write page at va: copy it,
+// or if no other page table shares it any more, just make
+// it writable again. Return 0, or -1 if va is not a
+// copy-on-write page or there is no memory for the copy.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(krefs(P2V(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    kfree(P2V(pa));
+    pa = V2P(mem);
+  }
+  *pte = pa | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  invlpg((void*)PGROUNDDOWN(va));
+  return 0;
+}
+
+// Fill mem with the page at a as the program file
+// gives it, if a lies in one of p's segments.
+static int
+loadpage(struct proc *p, uint a, char *mem)
+{
+  struct segment *s;
+  uint n;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(a < s->vaddr || a >= s->vaddr + s->memsz)
+      continue;
+    if(a >= s->vaddr + s->filesz)
+      return 0;
+    n = s->vaddr + s->filesz - a;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    ilock(p->exe);
+    if(readi(p->exe, mem, s->off + (a - s->vaddr), n) != n){
+      iunlock(p->exe);
+      return -1;
+    }
+    iunlock(p->exe);
+    return 0;
+  }
+  return 0;
+}
+
+// Map the pages of p wherever [va, va+len) is not mapped
+// yet. exec() leaves program segments to be read from the
+// file and sbrk() only moves p->sz, so such pages are
+// mapped on first touch, by a page fault or by the system
+// call that was passed them: from the program file inside
+// a segment, zeroed elsewhere. Reading the file may sleep.
+// If write is set, copy-on-write pages in the range are
+// copied too, so that the kernel can write there later
+// while holding a lock, without taking a fault.
+// p must be the current process.
+// Return 0, or -1 if the range does not lie below p->sz or
+// the page cannot be made.
+int
+lazymap(struct proc *p, uint va, uint len, int write)
+{
+  pte_t *pte;
+  char *mem;
+  uint a, last;
+
+  if(len == 0)
+    return 0;
+  if(va >= p->sz || va + len > p->sz || va + len < va)
+    return -1;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + len - 1);
+  for(;;){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || !(*pte & PTE_P)){
+      if((mem = kalloc()) == 0)
+        return -1;
+      memset(mem, 0, PGSIZE);
+      if(loadpage(p, a, mem) < 0 ||
+         mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+        kfree(mem);
+        return -1;
+      }
+    } else if(write && (*pte & PTE_COW) && cowfault(p->pgdir, a) < 0)
+      return -1;
+    if(a == last)
+      break;
+    a += PGSIZE;
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -352,25 +562,33 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
+  if(*pte & PTE_PS)
+    return (char*)P2V(PTE_ADDR(*pte) + PGROUNDDOWN((uint)uva % BIGPGSIZE));
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// The writes go through the kernel's mapping, which ignores
+// PTE_COW, so copy-on-write pages are copied first.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowfault(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -0,0 +1,24 @@
+#! /bin/bash
+#
+# Compare wall time of a batch script running many short commands with and
+# without the path cache of wish. The search path has a few directories in
+# front of /bin, so that every uncached lookup pays for failed access() calls.
+#
+# usage: ./bench-path-cache.sh [number of commands, default 100000]
+
+n=${1:-100000}
+tmp=$(mktemp -d)
+trap "rm -rf $tmp" EXIT
+
+gcc -O2 -o $tmp/wish-cache wish.c redirect.c parse.c profile.c history.c lineedit.c || exit 1
+gcc -O2 -DNO_PATH_CACHE -o $tmp/wish-nocache wish.c redirect.c parse.c profile.c history.c lineedit.c || exit 1
+
+mkdir $tmp/empty1 $tmp/empty2 $tmp/empty3
+echo "path $tmp/empty1 $tmp/empty2 $tmp/empty3 /bin" > $tmp/script
+yes true | head -n $n >> $tmp/script
+echo exit >> $tmp/script
+
+for variant in nocache cache; do
+    TIMEFORMAT="$variant: $n commands in %R s"
+    time $tmp/wish-$variant $tmp/script
+done
@@ -0,0 +1,304 @@
+/**
+ * @file   history.c
+ * @author O Hung Lun <hunglun.o@gmail.com>
+ *
+ * @brief  Command history kept on disk, with an index of line offsets
+ *
+ * The text file is mapped, never read into buffers. The index is loaded
+ * with a single read and only lines it does not cover are scanned, so
+ * opening a history of a million lines costs one read of 8 MB, and lines
+ * written by another shell are picked up by indexing just the new tail.
+ * A search scans the mapping backwards in large chunks with memmem, and
+ * turns the offset of a match into a line number by binary search.
+ */
+#define _GNU_SOURCE /*  memmem */
+#include <stdio.h> // snprintf
+#include <stdlib.h> // realloc
+#include <string.h> // memmem
+#include <unistd.h> // write
+#include <fcntl.h> // open
+#include <limits.h> // PATH_MAX
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include "history.h"
+
+#define HISTORY_SEARCH_CHUNK (1 << 20) // bytes scanned by one memmem pass
+#define HISTORY_MIN_MAP (1 << 16)      // smallest mapping of the text file
+/**
+ * map the text file again if it grew past the mapping
+ *
+ * The mapping is made twice as large as the file, so appending lines
+ * rarely needs a new mapping: with MAP_SHARED, bytes written past the
+ * old end of file show up in the pages already mapped.
+ *
+ * @param history
+ *
+ * @return 0 if success, otherwise -1.
+ */
+static int history_map(history_t * history){
+  struct stat sb;
+  if (fstat(history->fd, &sb) == -1) return -1;
+  if ((size_t)sb.st_size <= history->mapped){
+    history->size = sb.st_size;
+    return 0;
+  }
+  if (history->text != NULL) munmap(history->text, history->mapped);
+  history->text = NULL;
+  history->size = history->mapped = 0;
+  size_t mapped = sb.st_size * 2 > HISTORY_MIN_MAP ? sb.st_size * 2 : HISTORY_MIN_MAP;
+  char * text = mmap(NULL, mapped, PROT_READ, MAP_SHARED, history->fd, 0);
+  if (text == MAP_FAILED) return -1;
+  history->text = text;
+  history->size = sb.st_size;
+  history->mapped = mapped;
+  return 0;
+}
+/**
+ * add the offset of a line to the index in memory
+ *
+ * @param history
+ * @param offset
+ */
+static void history_push(history_t * history, uint64_t offset){
+  if (history->count == history->capacity){
+    history->capacity = history->capacity ? history->capacity * 2 : 1024;
+    history->offsets = realloc(history->offsets, sizeof(uint64_t) * history->capacity);
+  }
+  history->offsets[history->count++] = offset;
+}
+/**
+ * end of line i, at its '\n'
+ *
+ * @param history
+ * @param i
+ *
+ * @return offset of the '\n' ending line i.
+ */
+static size_t history_line_end(history_t * history, size_t i){
+  if (i + 1 < history->count) return history->offsets[i + 1] - 1;
+  char * start = history->text + history->offsets[i];
+  return (char *)memchr(start, '\n', history->size - history->offsets[i]) - history->text;
+}
+/**
+ * bring the index up to date with the text file
+ *
+ * The index is trusted if its last line starts right after a '\n' of
+ * the text; otherwise (the text was truncated or edited) it is rebuilt.
+ * Complete lines after the last indexed one are indexed, and their
+ * offsets are appended to the index file.
+ *
+ * @param history
+ *
+ * @return 0 if success, otherwise -1.
+ */
+static int history_sync(history_t * history){
+  if (history_map(history) != 0) return -1;
+  if (history->count > 0){
+    uint64_t last = history->offsets[history->count - 1];
+    if (last >= history->size || (last > 0 && history->text[last - 1] != '\n') ||
+        memchr(history->text + last, '\n', history->size - last) == NULL){
+      history->count = 0; /*  stale index */
+      if (ftruncate(history->index_fd, 0) == -1) return -1;
+    }
+  }
+  size_t indexed = history->count;
+  size_t next = (indexed == 0) ? 0 : history_line_end(history, indexed - 1) + 1;
+  while(next < history->size){
+    char * newline = memchr(history->text + next, '\n', history->size - next);
+    if (newline == NULL) break; /*  a line still being written */
+    history_push(history, next);
+    next = newline - history->text + 1;
+  }
+  size_t bytes = sizeof(uint64_t) * (history->count - indexed);
+  if (bytes > 0 && write(history->index_fd, history->offsets + indexed, bytes) != (ssize_t)bytes)
+    return -1;
+  return 0;
+}
+/**
+ * open the history stored in path, creating it if needed
+ *
+ * @param history
+ * @param path : text file; the index is path followed by ".idx".
+ *
+ * @return 0 if success, otherwise -1 with both files closed.
+ */
+int history_open(history_t * history, const char * path){
+  char index_path[PATH_MAX];
+  struct stat sb;
+  memset(history, 0, sizeof(history_t));
+  history->index_fd = -1;
+  history->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (history->fd == -1) return -1;
+  snprintf(index_path, sizeof(index_path), "%s.idx", path);
+  history->index_fd = open(index_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (history->index_fd == -1 || fstat(history->index_fd, &sb) == -1){
+    history_close(history);
+    return -1;
+  }
+  size_t count = sb.st_size / sizeof(uint64_t);
+  if (count > 0){
+    history->capacity = count;
+    history->offsets = malloc(sizeof(uint64_t) * count);
+    if (pread(history->index_fd, history->offsets, sizeof(uint64_t) * count, 0) ==
+        (ssize_t)(sizeof(uint64_t) * count))
+      history->count = count;
+  }
+  if (sb.st_size % sizeof(uint64_t) != 0 || history->count != count){
+    history->count = 0; /*  torn write: rebuild */
+    if (ftruncate(history->index_fd, 0) == -1){
+      history_close(history);
+      return -1;
+    }
+  }
+  if (history_sync(history) != 0){ /*  mapping or index write failed */
+    history_close(history);
+    return -1;
+  }
+  return 0;
+}
+/**
+ * release the mapping and the index, and close both files
+ *
+ * @param history
+ */
+void history_close(history_t * history){
+  if (history->text != NULL) munmap(history->text, history->mapped);
+  if (history->fd != -1) close(history->fd);
+  if (history->index_fd != -1) close(history->index_fd);
+  free(history->offsets);
+  memset(history, 0, sizeof(history_t));
+  history->fd = history->index_fd = -1;
+}
+/**
+ * append a line to the history
+ *
+ * Empty lines and repeats of the previous line are not recorded. The
+ * line and its '\n' are written at once, so shells sharing the file do
+ * not interleave within a line.
+ *
+ * @param history
+ * @param line : without '\n'.
+ * @param len
+ *
+ * @return 0 if success or not recorded, otherwise -1.
+ */
+int history_add(history_t * history, const char * line, size_t len){
+  size_t last_len;
+  if (history->fd == -1 || len == 0) return 0;
+  if (history->count > 0){
+    const char * last = history_line(history, history->count - 1, &last_len);
+    if (last_len == len && memcmp(last, line, len) == 0) return 0;
+  }
+  char * record = malloc(len + 1);
+  memcpy(record, line, len);
+  record[len] = '\n';
+  ssize_t written = write(history->fd, record, len + 1);
+  free(record);
+  if (written != (ssize_t)(len + 1)) return -1;
+  return history_sync(history);
+}
+/**
+ * get line i, the oldest being 0
+ *
+ * @param history
+ * @param i : less than history->count.
+ * @param len : set to the length of the line, without '\n'.
+ *
+ * @return the line in the mapping, not terminated by '\0'.
+ */
+const char * history_line(history_t * history, size_t i, size_t * len){
+  *len = history_line_end(history, i) - history->offsets[i];
+  return history->text + history->offsets[i];
+}
+/**
+ * find the most recent line before a given one which contains query
+ *
+ * @param history
+ * @param query : without '\n'.
+ * @param len : length of query.
+ * @param before : only lines older than this one are searched.
+ *
+ * @return number of the line, or -1 if there is none.
+ */
+long history_search(history_t * history, const char * query, size_t len, size_t before){
+  if (before > history->count) before = history->count;
+  if (before == 0 || len > HISTORY_SEARCH_CHUNK) return -1;
+  if (len == 0) return before - 1;
+  size_t end = history_line_end(history, before - 1);
+  for(;;){
+    size_t start = end > HISTORY_SEARCH_CHUNK ? end - HISTORY_SEARCH_CHUNK : 0;
+    char * found = NULL;
+    char * p = history->text + start;
+    char * stop = history->text + end;
+    /*  memmem only searches forwards: keep the last match of the chunk */
+    while((p = memmem(p, stop - p, query, len)) != NULL) found = p++;
+    if (found != NULL){
+      uint64_t offset = found - history->text;
+      size_t lo = 0, hi = before; /*  last line starting at or before offset */
+      while(hi - lo > 1){
+        size_t mid = lo + (hi - lo) / 2;
+        if (history->offsets[mid] <= offset) lo = mid;
+        else hi = mid;
+      }
+      return lo;
+    }
+    if (start == 0) return -1;
+    end = start + len - 1; /*  a match may straddle the chunk boundary */
+  }
+}
+#ifdef TEST
+#include <assert.h>
+#include <time.h>
+int main(int argc, char *argv[]){
+  history_t history;
+  char path[] = "/tmp/wish-history-XXXXXX";
+  char index_path[sizeof(path) + 4];
+  char line[64];
+  size_t len;
+  int fd = mkstemp(path);
+  assert(fd != -1);
+  close(fd);
+  snprintf(index_path, sizeof(index_path), "%s.idx", path);
+  // test 1: lines are appended, empty lines and repeats are dropped
+  assert(history_open(&history, path) == 0 && history.count == 0);
+  assert(history_add(&history, "ls -l", 5) == 0);
+  assert(history_add(&history, "ls -l", 5) == 0);
+  assert(history_add(&history, "", 0) == 0);
+  assert(history_add(&history, "cat a | wc", 10) == 0);
+  assert(history.count == 2);
+  assert(memcmp(history_line(&history, 1, &len), "cat a | wc", 10) == 0 && len == 10);
+  // test 2: reopening uses the index, lines appended by others are indexed
+  history_close(&history);
+  fd = open(path, O_WRONLY | O_APPEND);
+  assert(write(fd, "echo other\npartial", 18) == 18);
+  close(fd);
+  assert(history_open(&history, path) == 0 && history.count == 3);
+  assert(memcmp(history_line(&history, 2, &len), "echo other", 10) == 0 && len == 10);
+  // test 3: a stale index is rebuilt
+  history_close(&history);
+  assert(truncate(path, 6) == 0);
+  assert(history_open(&history, path) == 0 && history.count == 1);
+  // test 4: search from the most recent line, across many chunks
+  for(int i=0; i<1000000; i++){
+    len = snprintf(line, sizeof(line), "echo line %d", i);
+    if (i == 10) len = snprintf(line, sizeof(line), "grep needle haystack");
+    history_add(&history, line, len);
+  }
+  assert(history.count == 1000001);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  assert(history_search(&history, "line 999999", 11, history.count) == 1000000);
+  assert(history_search(&history, "line 99999", 10, 900000) == 100000);
+  assert(history_search(&history, "needle", 6, history.count) == 11);
+  assert(history_search(&history, "no such line", 12, history.count) == -1);
+  assert(history_search(&history, "ls", 2, history.count) == 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("history: searched %zu lines in %.1f ms\n", history.count,
+         (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+  history_close(&history);
+  unlink(path);
+  unlink(index_path);
+  printf("history: all tests passed\n");
+  return 0;
+}
+#endif //TEST
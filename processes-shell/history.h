@@ -0,0 +1,35 @@
+/**
+ * @file   history.h
+ * @author O Hung Lun <hunglun.o@gmail.com>
+ *
+ * @brief  Command history kept on disk, with an index of line offsets
+ *
+ * Lines are appended to a text file, one command per line. A second file,
+ * the text file's name followed by ".idx", holds the offset of the start
+ * of every line as 64-bit integers, so the history is opened without
+ * reading its text and any line is found in O(1).
+ */
+#ifndef history_h
+#define history_h
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+typedef struct history {
+  int fd;             // text file, opened for appending
+  int index_fd;       // index file, opened for appending
+  char * text;        // shared mapping of the text file, or NULL
+  size_t size;        // bytes of the text file
+  size_t mapped;      // bytes mapped, past the end of the file
+  uint64_t * offsets; // start of each complete line
+  size_t count;       // lines in offsets
+  size_t capacity;    // slots allocated for offsets
+} history_t;
+
+int history_open(history_t * history, const char * path);
+void history_close(history_t * history);
+int history_add(history_t * history, const char * line, size_t len);
+const char * history_line(history_t * history, size_t i, size_t * len);
+long history_search(history_t * history, const char * query, size_t len, size_t before);
+
+#endif //history_h
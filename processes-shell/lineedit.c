@@ -0,0 +1,564 @@
+/**
+ * @file   lineedit.c
+ * @author O Hung Lun <hunglun.o@gmail.com>
+ *
+ * @brief  Line editor of interactive mode: editing keys, history search
+ * and tab completion
+ *
+ * The terminal is in raw mode only while a line is being read, so
+ * commands run with the user's settings. The line is redrawn on a single
+ * row after each key, with one write.
+ *
+ * Keys: Left/Right (^B/^F), Home/End (^A/^E), Backspace, Delete, ^K, ^U,
+ * ^L, Up/Down (^P/^N) browse the history, ^R searches it backwards as
+ * the query is typed, Tab completes, ^C drops the line and ^D on an
+ * empty line is end of file.
+ *
+ * Program names are completed from listings of the search path
+ * directories. Each listing is read once, sorted, and kept until the
+ * directory's mtime changes, so completing is a binary search per
+ * directory.
+ */
+#define _GNU_SOURCE /*  memrchr, strndup */
+#include <stdio.h> // snprintf
+#include <stdlib.h> // malloc
+#include <string.h> // memmove
+#include <unistd.h> // read
+#include <fcntl.h> // O_RDONLY
+#include <dirent.h> // opendir
+#include <poll.h> // poll
+#include <termios.h> // tcsetattr
+#include <sys/stat.h> // fstatat
+#include "lineedit.h"
+
+#undef CTRL // glibc's <termios.h> happens to define it, other C libraries do not
+#define CTRL(c) ((c) & 0x1f) // key code of Ctrl + c
+#define ESCAPE_TIMEOUT_MS 50 // a lone Escape is not followed within this delay
+
+enum key {
+  KEY_UP = 256, /*  above every byte */
+  KEY_DOWN,
+  KEY_LEFT,
+  KEY_RIGHT,
+  KEY_HOME,
+  KEY_END,
+  KEY_DELETE,
+  KEY_ESCAPE,
+};
+
+typedef struct listing {
+  char * dir;             // directory of the search path, or NULL
+  struct timespec mtime;  // of dir when it was read
+  char ** names;          // executable files, sorted
+  size_t count;
+} listing_t;
+
+typedef struct candidates {
+  char ** names;
+  size_t count;
+  size_t capacity;
+} candidates_t;
+
+typedef struct editor {
+  char * buf;             // the line, not terminated
+  size_t len;
+  size_t capacity;
+  size_t pos;             // cursor
+  const char * prompt;
+  size_t browse;          // history line shown; history->count for a new line
+  char * draft;           // the new line, kept while browsing
+  size_t draft_len;
+} editor_t;
+
+static history_t * g_history = NULL;
+static char ** g_paths = NULL;
+static int g_path_count = 0;
+static listing_t * g_listings = NULL; /*  one per entry of g_paths */
+static char * g_builtins[] = { "cd", "exit", "jobs", "path", "time", "wait" };
+/**
+ * set up the editor
+ *
+ * @param history : lines are browsed, searched and added here.
+ * @param paths : search path of the shell, NULL entries are skipped. The
+ *                array is read at each completion, so later changes by
+ *                the path builtin are seen.
+ * @param path_count : entries in paths.
+ */
+void lineedit_init(history_t * history, char ** paths, int path_count){
+  g_history = history;
+  g_paths = paths;
+  g_path_count = path_count;
+  g_listings = calloc(path_count, sizeof(listing_t));
+}
+/**
+ * qsort comparator of strings
+ */
+static int compare_names(const void * a, const void * b){
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+/**
+ * add a copy of name followed by suffix to candidates
+ *
+ * @param candidates
+ * @param name
+ * @param suffix : "/" for directories, otherwise "".
+ */
+static void add_candidate(candidates_t * candidates, const char * name, const char * suffix){
+  if (candidates->count == candidates->capacity){
+    candidates->capacity = candidates->capacity ? candidates->capacity * 2 : 16;
+    candidates->names = realloc(candidates->names, sizeof(char *) * candidates->capacity);
+  }
+  char * copy = malloc(strlen(name) + strlen(suffix) + 1);
+  strcpy(stpcpy(copy, name), suffix);
+  candidates->names[candidates->count++] = copy;
+}
+/**
+ * free the names of a listing
+ *
+ * @param listing
+ */
+static void free_listing(listing_t * listing){
+  for(size_t i=0; i<listing->count; i++) free(listing->names[i]);
+  free(listing->names);
+  free(listing->dir);
+  memset(listing, 0, sizeof(listing_t));
+}
+/**
+ * get the listing of search path entry i, reading the directory only if
+ * it changed since the last time
+ *
+ * @param i
+ *
+ * @return the listing, or NULL if the directory cannot be read.
+ */
+static listing_t * get_listing(int i){
+  listing_t * listing = &g_listings[i];
+  struct stat sb;
+  if (stat(g_paths[i], &sb) == -1) {
+    free_listing(listing);
+    return NULL;
+  }
+  if (listing->dir != NULL && strcmp(listing->dir, g_paths[i]) == 0 &&
+      listing->mtime.tv_sec == sb.st_mtim.tv_sec &&
+      listing->mtime.tv_nsec == sb.st_mtim.tv_nsec)
+    return listing;
+  free_listing(listing);
+  DIR * dir = opendir(g_paths[i]);
+  if (dir == NULL) return NULL;
+  candidates_t names = { NULL, 0, 0 };
+  struct dirent * entry;
+  struct stat st;
+  while((entry = readdir(dir)) != NULL){
+    if (entry->d_name[0] == '.') continue;
+    if (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 &&
+        S_ISREG(st.st_mode) && (st.st_mode & 0111))
+      add_candidate(&names, entry->d_name, "");
+  }
+  closedir(dir);
+  qsort(names.names, names.count, sizeof(char *), compare_names);
+  listing->dir = strdup(g_paths[i]);
+  listing->mtime = sb.st_mtim;
+  listing->names = names.names;
+  listing->count = names.count;
+  return listing;
+}
+/**
+ * find the programs of the search path whose names start with prefix
+ *
+ * @param candidates
+ * @param prefix
+ * @param len : length of prefix.
+ */
+static void complete_program(candidates_t * candidates, const char * prefix, size_t len){
+  for(size_t i=0; i<sizeof(g_builtins)/sizeof(g_builtins[0]); i++)
+    if (strncmp(g_builtins[i], prefix, len) == 0) add_candidate(candidates, g_builtins[i], "");
+  for(int i=0; i<g_path_count; i++){
+    if (g_paths[i] == NULL) continue;
+    listing_t * listing = get_listing(i);
+    if (listing == NULL) continue;
+    size_t lo = 0, hi = listing->count; /*  first name not below prefix */
+    while(lo < hi){
+      size_t mid = lo + (hi - lo) / 2;
+      if (strncmp(listing->names[mid], prefix, len) < 0) lo = mid + 1;
+      else hi = mid;
+    }
+    for(; lo < listing->count && strncmp(listing->names[lo], prefix, len) == 0; lo++)
+      add_candidate(candidates, listing->names[lo], "");
+  }
+}
+/**
+ * find the files whose paths start with word
+ *
+ * Directories are listed on demand, since the current directory changes.
+ *
+ * @param candidates : names relative to the directory part of word.
+ * @param word
+ * @param len : length of word.
+ *
+ * @return length of the directory part of word.
+ */
+static size_t complete_file(candidates_t * candidates, const char * word, size_t len){
+  const char * slash = memrchr(word, '/', len);
+  size_t dir_len = (slash == NULL) ? 0 : slash - word + 1;
+  char * dir_path = (dir_len == 0) ? strdup(".") : strndup(word, dir_len);
+  const char * prefix = word + dir_len;
+  size_t prefix_len = len - dir_len;
+  DIR * dir = opendir(dir_path);
+  free(dir_path);
+  if (dir == NULL) return dir_len;
+  struct dirent * entry;
+  struct stat st;
+  while((entry = readdir(dir)) != NULL){
+    if (strncmp(entry->d_name, prefix, prefix_len) != 0) continue;
+    if (entry->d_name[0] == '.' && (prefix_len == 0 || strcmp(entry->d_name, ".") == 0 ||
+                                    strcmp(entry->d_name, "..") == 0))
+      continue; /*  hidden files only when asked for */
+    int is_dir = fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+    add_candidate(candidates, entry->d_name, is_dir ? "/" : "");
+  }
+  closedir(dir);
+  return dir_len;
+}
+/**
+ * grow the line to hold extra more bytes
+ *
+ * @param e
+ * @param extra
+ */
+static void reserve(editor_t * e, size_t extra){
+  if (e->len + extra <= e->capacity) return;
+  while(e->len + extra > e->capacity) e->capacity = e->capacity ? e->capacity * 2 : 128;
+  e->buf = realloc(e->buf, e->capacity);
+}
+/**
+ * insert text at the cursor
+ *
+ * @param e
+ * @param text
+ * @param len
+ */
+static void insert(editor_t * e, const char * text, size_t len){
+  reserve(e, len);
+  memmove(e->buf + e->pos + len, e->buf + e->pos, e->len - e->pos);
+  memcpy(e->buf + e->pos, text, len);
+  e->len += len;
+  e->pos += len;
+}
+/**
+ * replace the whole line, with the cursor at its end
+ *
+ * @param e
+ * @param text
+ * @param len
+ */
+static void set_line(editor_t * e, const char * text, size_t len){
+  e->len = e->pos = 0;
+  insert(e, text, len);
+}
+/**
+ * delete len bytes starting at offset at
+ *
+ * @param e
+ * @param at
+ * @param len
+ */
+static void erase(editor_t * e, size_t at, size_t len){
+  memmove(e->buf + at, e->buf + at + len, e->len - at - len);
+  e->len -= len;
+  if (e->pos > at) e->pos = (e->pos > at + len) ? e->pos - len : at;
+}
+/**
+ * redraw the row: prompt, text, and the cursor pos bytes into text
+ *
+ * @param prompt
+ * @param text
+ * @param len
+ * @param pos
+ */
+static void refresh(const char * prompt, const char * text, size_t len, size_t pos){
+  size_t prompt_len = strlen(prompt);
+  char * out = malloc(prompt_len + len + 32);
+  char * end = out;
+  *end++ = '\r';
+  end = stpcpy(end, prompt);
+  memcpy(end, text, len);
+  end += len;
+  end = stpcpy(end, "\x1b[K\r"); /*  erase the rest of the row */
+  if (prompt_len + pos > 0) end += sprintf(end, "\x1b[%zuC", prompt_len + pos);
+  if (write(STDOUT_FILENO, out, end - out) == -1) { /*  nothing to do */ }
+  free(out);
+}
+/**
+ * read one key, decoding the escape sequences of arrows and such
+ *
+ * @return a byte, a key_t value, or -1 at end of input.
+ */
+static int read_key(void){
+  unsigned char c, seq[3];
+  struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+  if (read(STDIN_FILENO, &c, 1) != 1) return -1;
+  if (c != 27) return c;
+  if (poll(&pfd, 1, ESCAPE_TIMEOUT_MS) != 1 || read(STDIN_FILENO, &seq[0], 1) != 1 ||
+      read(STDIN_FILENO, &seq[1], 1) != 1)
+    return KEY_ESCAPE;
+  if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9'){
+    if (read(STDIN_FILENO, &seq[2], 1) != 1 || seq[2] != '~') return KEY_ESCAPE;
+    switch(seq[1]){
+    case '1': case '7': return KEY_HOME;
+    case '4': case '8': return KEY_END;
+    case '3': return KEY_DELETE;
+    default: return KEY_ESCAPE;
+    }
+  }
+  if (seq[0] != '[' && seq[0] != 'O') return KEY_ESCAPE;
+  switch(seq[1]){
+  case 'A': return KEY_UP;
+  case 'B': return KEY_DOWN;
+  case 'C': return KEY_RIGHT;
+  case 'D': return KEY_LEFT;
+  case 'H': return KEY_HOME;
+  case 'F': return KEY_END;
+  default: return KEY_ESCAPE;
+  }
+}
+/**
+ * show history line i, or the new line when i is history->count
+ *
+ * @param e
+ * @param i
+ */
+static void browse(editor_t * e, size_t i){
+  size_t len;
+  if (e->browse == g_history->count){ /*  leaving the new line: keep it */
+    free(e->draft);
+    e->draft = malloc(e->len + 1);
+    memcpy(e->draft, e->buf, e->len);
+    e->draft_len = e->len;
+  }
+  e->browse = i;
+  if (i == g_history->count) set_line(e, e->draft, e->draft_len);
+  else {
+    const char * line = history_line(g_history, i, &len);
+    set_line(e, line, len);
+  }
+}
+/**
+ * reverse incremental search (^R)
+ *
+ * Each typed character narrows the search from the current match, so
+ * the match only moves back in time; ^R again finds an older match.
+ *
+ * @param e : set to the match when the search is accepted.
+ *
+ * @return the key which ended the search, to be handled as usual, or 0
+ *         if the search was cancelled.
+ */
+static int reverse_search(editor_t * e){
+  char query[256];
+  char prompt[sizeof(query) + 32];
+  size_t query_len = 0;
+  size_t len = 0;
+  long match = -1;
+  const char * text = "";
+  for(;;){
+    snprintf(prompt, sizeof(prompt), "(%sreverse-i-search)`%.*s': ",
+             (match == -1 && query_len > 0) ? "failing " : "", (int)query_len, query);
+    refresh(prompt, text, len, len);
+    int key = read_key();
+    long from = (match == -1) ? (long)g_history->count : match + 1;
+    if (key == CTRL('r')) {
+      from = (match == -1) ? (long)g_history->count : match; /*  older */
+    } else if (key == 127 || key == CTRL('h')) {
+      if (query_len > 0) query_len--;
+      from = g_history->count;
+    } else if (key >= 32 && key < 127 && query_len < sizeof(query)) {
+      query[query_len++] = key;
+    } else if (key == CTRL('g') || key == KEY_ESCAPE) {
+      return 0;
+    } else {
+      if (match != -1) {
+        e->browse = g_history->count;
+        set_line(e, text, len);
+      }
+      return key;
+    }
+    long found = history_search(g_history, query, query_len, from);
+    if (found != -1 || key == CTRL('r')) match = (found != -1) ? found : match;
+    else match = -1;
+    if (match != -1) text = history_line(g_history, match, &len);
+    else {
+      text = "";
+      len = 0;
+    }
+  }
+}
+/**
+ * complete the word before the cursor (Tab)
+ *
+ * The first word of a command is completed as a program, other words as
+ * files. A unique match is inserted; several matches are completed up to
+ * their common prefix, and listed if there is nothing to insert.
+ *
+ * @param e
+ */
+static void complete(editor_t * e){
+  size_t start = e->pos;
+  while(start > 0 && strchr(" \t|&<>", e->buf[start - 1]) == NULL) start--;
+  size_t before = start;
+  while(before > 0 && (e->buf[before - 1] == ' ' || e->buf[before - 1] == '\t')) before--;
+  int is_program = (before == 0 || e->buf[before - 1] == '|' || e->buf[before - 1] == '&');
+  char * word = strndup(e->buf + start, e->pos - start);
+  size_t word_len = e->pos - start;
+  candidates_t candidates = { NULL, 0, 0 };
+  size_t dir_len = 0;
+  if (is_program && memchr(word, '/', word_len) == NULL)
+    complete_program(&candidates, word, word_len);
+  else
+    dir_len = complete_file(&candidates, word, word_len);
+  size_t typed = word_len - dir_len; /*  part of the names already typed */
+  qsort(candidates.names, candidates.count, sizeof(char *), compare_names);
+  size_t unique = 0; /*  the same program may be in several directories */
+  for(size_t i=0; i<candidates.count; i++){
+    if (unique > 0 && strcmp(candidates.names[unique - 1], candidates.names[i]) == 0)
+      free(candidates.names[i]);
+    else candidates.names[unique++] = candidates.names[i];
+  }
+  if (unique > 0){
+    size_t common = strlen(candidates.names[0]);
+    for(size_t i=1; i<unique; i++){
+      size_t j = 0;
+      while(j < common && candidates.names[i][j] == candidates.names[0][j]) j++;
+      common = j;
+    }
+    if (common > typed) insert(e, candidates.names[0] + typed, common - typed);
+    if (unique == 1 && candidates.names[0][common - 1] != '/') insert(e, " ", 1);
+    if (unique > 1 && common == typed){
+      if (write(STDOUT_FILENO, "\n", 1) == -1) { /*  nothing to do */ }
+      for(size_t i=0; i<unique; i++) printf("%s%s", candidates.names[i], i + 1 < unique ? "  " : "\n");
+      fflush(stdout);
+    }
+  }
+  for(size_t i=0; i<unique; i++) free(candidates.names[i]);
+  free(candidates.names);
+  free(word);
+}
+/**
+ * read a line from the terminal, with editing
+ *
+ * Works like getline on stdin. A line which is not empty is added to the
+ * history. If stdin is not a terminal, getline is used.
+ *
+ * @param line : buffer, reallocated as needed.
+ * @param cap : size of *line.
+ * @param prompt
+ *
+ * @return length of the line, which ends with '\n', or -1 at end of file.
+ */
+ssize_t lineedit_read(char ** line, size_t * cap, const char * prompt){
+  struct termios saved, raw;
+  if (tcgetattr(STDIN_FILENO, &saved) == -1) {
+    printf("%s", prompt);
+    fflush(stdout);
+    return getline(line, cap, stdin);
+  }
+  raw = saved;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  fflush(stdout);
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+  editor_t e = { NULL, 0, 0, 0, prompt, g_history->count, NULL, 0 };
+  int eof = 0;
+  int key = 0;
+  for(;;){
+    refresh(e.prompt, e.buf, e.len, e.pos);
+    if (key == 0) key = read_key();
+    if (key == CTRL('r')) {
+      key = reverse_search(&e);
+      continue; /*  handle the key which ended the search */
+    }
+    if (key == '\r' || key == '\n') break;
+    if (key == -1 || (key == CTRL('d') && e.len == 0)) {
+      eof = 1;
+      break;
+    }
+    switch(key){
+    case CTRL('c'):
+      if (write(STDOUT_FILENO, "^C\n", 3) == -1) { /*  nothing to do */ }
+      e.len = e.pos = 0;
+      e.browse = g_history->count;
+      break;
+    case 127:
+    case CTRL('h'):
+      if (e.pos > 0) erase(&e, e.pos - 1, 1);
+      break;
+    case CTRL('d'):
+    case KEY_DELETE:
+      if (e.pos < e.len) erase(&e, e.pos, 1);
+      break;
+    case CTRL('b'):
+    case KEY_LEFT:
+      if (e.pos > 0) e.pos--;
+      break;
+    case CTRL('f'):
+    case KEY_RIGHT:
+      if (e.pos < e.len) e.pos++;
+      break;
+    case CTRL('a'):
+    case KEY_HOME:
+      e.pos = 0;
+      break;
+    case CTRL('e'):
+    case KEY_END:
+      e.pos = e.len;
+      break;
+    case CTRL('k'):
+      e.len = e.pos;
+      break;
+    case CTRL('u'):
+      erase(&e, 0, e.pos);
+      break;
+    case CTRL('l'):
+      if (write(STDOUT_FILENO, "\x1b[H\x1b[2J", 7) == -1) { /*  nothing to do */ }
+      break;
+    case CTRL('p'):
+    case KEY_UP:
+      if (e.browse > 0) browse(&e, e.browse - 1);
+      break;
+    case CTRL('n'):
+    case KEY_DOWN:
+      if (e.browse < g_history->count) browse(&e, e.browse + 1);
+      break;
+    case '\t':
+      complete(&e);
+      break;
+    default:
+      if (key >= 32 && key < 256 && key != 127) {
+        char c = key;
+        insert(&e, &c, 1);
+      }
+    }
+    key = 0;
+  }
+  e.pos = e.len;
+  refresh(e.prompt, e.buf, e.len, e.pos);
+  if (write(STDOUT_FILENO, "\n", 1) == -1) { /*  nothing to do */ }
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+  free(e.draft);
+  if (eof) {
+    free(e.buf);
+    return -1;
+  }
+  history_add(g_history, e.buf, e.len);
+  if (*cap < e.len + 2){
+    *cap = e.len + 2;
+    *line = realloc(*line, *cap);
+  }
+  if (e.len > 0) memcpy(*line, e.buf, e.len);
+  (*line)[e.len] = '\n';
+  (*line)[e.len + 1] = '\0';
+  free(e.buf);
+  return e.len + 1;
+}
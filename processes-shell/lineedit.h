@@ -0,0 +1,17 @@
+/**
+ * @file   lineedit.h
+ * @author O Hung Lun <hunglun.o@gmail.com>
+ *
+ * @brief  Line editor of interactive mode: editing keys, history search
+ * and tab completion
+ */
+#ifndef lineedit_h
+#define lineedit_h
+
+#include <sys/types.h> // ssize_t
+#include "history.h" // history_t
+
+void lineedit_init(history_t * history, char ** paths, int path_count);
+ssize_t lineedit_read(char ** line, size_t * cap, const char * prompt);
+
+#endif //lineedit_h
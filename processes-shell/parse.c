@@ -0,0 +1,330 @@
+/**
+ * @file   parse.c
+ * @author O Hung Lun <hunglun.o@gmail.com>
+ *
+ * @brief  Single-pass command line parser
+ *
+ * The line is scanned once, left to right. Each word is terminated in
+ * place by overwriting the character that ends it, so no word is copied
+ * and no strlen is needed. Syntax errors are found during the same scan.
+ */
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy
+#include <assert.h> // assert
+#include "parse.h"
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN sizeof(void *)
+#define ARGV_INITIAL_CAPACITY 8
+
+typedef struct parser {
+  arena_t * arena;
+  group_t * group;
+  pipeline_t ** pipeline_tail; // where the next pipeline is linked
+  command_t ** command_tail;   // where the next stage is linked
+  pipeline_t * pipeline;       // pipeline being parsed, or NULL
+  command_t * command;         // command being parsed, or NULL
+  int argv_capacity;           // slots allocated for command->argv
+  char ** expect_path;         // where the file after a redirection goes, or NULL
+  int redirected;              // the command has a redirection, no word may follow
+} parser_t;
+/**
+ * allocate memory which lives until the next arena_reset
+ *
+ * @param arena
+ * @param size
+ *
+ * @return aligned memory
+ */
+void * arena_alloc(arena_t * arena, size_t size){
+  arena_block_t * block = arena->head;
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (block == NULL || block->size - block->used < size){
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(arena_block_t) + block_size);
+    assert(block != NULL);
+    block->next = arena->head;
+    block->used = 0;
+    block->size = block_size;
+    arena->head = block;
+  }
+  arena->last = block->data + block->used;
+  block->used += size;
+  return arena->last;
+}
+/**
+ * grow an allocation, in place if it is the last one of the arena
+ *
+ * @param arena
+ * @param ptr
+ * @param old_size
+ * @param new_size
+ *
+ * @return the grown allocation, the content of ptr is kept.
+ */
+static void * arena_grow(arena_t * arena, void * ptr, size_t old_size, size_t new_size){
+  arena_block_t * block = arena->head;
+  size_t offset = (char *)ptr - block->data;
+  new_size = (new_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (ptr == arena->last && offset + new_size <= block->size){
+    block->used = offset + new_size;
+    return ptr;
+  }
+  void * grown = arena_alloc(arena, new_size);
+  memcpy(grown, ptr, old_size);
+  return grown;
+}
+/**
+ * release everything allocated since the last reset
+ *
+ * The most recent block is kept for the next line.
+ *
+ * @param arena
+ */
+void arena_reset(arena_t * arena){
+  if (arena->head == NULL) return;
+  arena_block_t * block = arena->head->next;
+  while(block != NULL){
+    arena_block_t * next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->head->next = NULL;
+  arena->head->used = 0;
+  arena->last = NULL;
+}
+/**
+ * start a new command, and a new pipeline if there is none
+ *
+ * @param p
+ */
+static void start_command(parser_t * p){
+  if (p->pipeline == NULL){
+    p->pipeline = arena_alloc(p->arena, sizeof(pipeline_t));
+    p->pipeline->first = NULL;
+    p->pipeline->stage_count = 0;
+    p->pipeline->next = NULL;
+    p->group->pipeline_count++;
+    *p->pipeline_tail = p->pipeline;
+    p->pipeline_tail = &p->pipeline->next;
+    p->command_tail = &p->pipeline->first;
+  }
+  p->command = arena_alloc(p->arena, sizeof(command_t));
+  memset(p->command, 0, sizeof(command_t));
+  p->redirected = 0;
+  p->command->next = NULL;
+  p->argv_capacity = ARGV_INITIAL_CAPACITY;
+  p->command->argv = arena_alloc(p->arena, sizeof(char *) * p->argv_capacity);
+  *p->command_tail = p->command;
+  p->command_tail = &p->command->next;
+  p->pipeline->stage_count++;
+}
+/**
+ * add a word to the current command
+ *
+ * @param p
+ * @param word : terminated in place.
+ *
+ * @return -1 if a word follows a redirection, otherwise 0.
+ */
+static int add_word(parser_t * p, char * word){
+  if (p->command == NULL) start_command(p);
+  if (p->expect_path != NULL){
+    *p->expect_path = word;
+    p->expect_path = NULL;
+    return 0;
+  }
+  if (p->redirected) return -1; /*  "ls > a b" */
+  if (p->command->argc + 1 == p->argv_capacity){ /*  keep room for NULL */
+    p->command->argv = arena_grow(p->arena, p->command->argv,
+                                  sizeof(char *) * p->argv_capacity,
+                                  sizeof(char *) * p->argv_capacity * 2);
+    p->argv_capacity *= 2;
+  }
+  p->command->argv[p->command->argc++] = word;
+  return 0;
+}
+/**
+ * handle '<', '>', '>>', '2>', '2>>' or '2>&1'
+ *
+ * @param p
+ * @param op : '<' or '>'.
+ * @param rest : the line after op.
+ * @param fd : 2 if the operator is preceded by "2", otherwise 0 or 1.
+ *
+ * @return number of characters of the operator taken from rest, or -1 if
+ *         the stream is already redirected.
+ */
+static int add_redirection(parser_t * p, char op, char * rest, int fd){
+  if (p->command == NULL) start_command(p);
+  command_t * cmd = p->command;
+  if (p->expect_path != NULL) return -1; /*  "ls > > a" */
+  p->redirected = 1;
+  if (op == '<') {
+    if (cmd->in_path != NULL) return -1;
+    p->expect_path = &cmd->in_path;
+    return 0;
+  }
+  int append = (rest[0] == '>');
+  if (fd == 1) {
+    if (cmd->out_path != NULL) return -1; /*  "ls > a > b" */
+    cmd->out_append = append;
+    p->expect_path = &cmd->out_path;
+    return append;
+  }
+  if (cmd->err_path != NULL || cmd->err_to_out) return -1;
+  if (rest[0] == '&' && rest[1] == '1') {
+    cmd->err_to_out = 1;
+    return 2;
+  }
+  cmd->err_append = append;
+  p->expect_path = &cmd->err_path;
+  return append;
+}
+/**
+ * finish the current command at '|', '&' or end of line
+ *
+ * @param p
+ *
+ * @return -1 if there is no command, no program or a missing output file.
+ */
+static int end_command(parser_t * p){
+  if (p->command == NULL ||  /*  "| a" or "a | | b" */
+      p->expect_path != NULL || /*  "ls >" */
+      p->command->argc == 0) /*  "> a" */
+    return -1;
+  p->command->argv[p->command->argc] = NULL; /*  execv expects argv to end with NULL. */
+  p->command = NULL;
+  return 0;
+}
+/**
+ * finish the current pipeline at '&' or end of line
+ *
+ * Empty pipelines ("&", "a & & b") are allowed and skipped.
+ *
+ * @param p
+ *
+ * @return -1 if the last stage is missing or invalid, otherwise 0.
+ */
+static int end_pipeline(parser_t * p){
+  if (p->pipeline == NULL) return 0;
+  if (end_command(p) != 0) return -1; /*  also "a |" */
+  p->pipeline = NULL;
+  return 0;
+}
+/**
+ * parse line into a group of pipelines
+ *
+ * Runs in O(length of line). line is modified: words are terminated in
+ * place and referenced from the result. The line ends at '\0' or '\n'.
+ *
+ * @param arena : every node of group is allocated here.
+ * @param line
+ * @param group : the result, possibly empty.
+ *
+ * @return 0 if line is valid, -1 on syntax error.
+ */
+int parse_line(arena_t * arena, char * line, group_t * group){
+  parser_t p = { arena, group, &group->first, NULL, NULL, NULL, 0, NULL, 0 };
+  char * c = line;
+  group->first = NULL;
+  group->pipeline_count = 0;
+  group->background = 0;
+  for(;;){
+    while (*c == ' ' || *c == '\t') c++;
+    char * word = c;
+    while (*c != ' ' && *c != '\t' && *c != '\0' && *c != '\n' &&
+           *c != '&' && *c != '|' && *c != '>' && *c != '<') c++;
+    char stop = *c;
+    int fd = (stop == '>') ? 1 : 0;
+    if (stop == '>' && c == word + 1 && word[0] == '2') {
+      fd = 2; /*  "2>" is an operator, not the word "2" */
+    } else if (c != word){
+      *c = '\0';
+      if (add_word(&p, word) != 0) return -1;
+    }
+    switch(stop){
+    case ' ':
+    case '\t':
+      break;
+    case '<':
+    case '>': {
+      int extra = add_redirection(&p, stop, c + 1, fd);
+      if (extra < 0) return -1;
+      c += extra;
+      break;
+    }
+    case '|':
+      if (end_command(&p) != 0) return -1;
+      break;
+    case '&':
+      if (end_pipeline(&p) != 0) return -1;
+      group->background = (group->pipeline_count > 0);
+      break;
+    default: /*  end of line */
+      if (p.pipeline != NULL) group->background = 0; /*  a command follows the last '&' */
+      return end_pipeline(&p);
+    }
+    c++;
+  }
+}
+#ifdef TEST
+#include <stdio.h>
+int main(int argc, char *argv[]){
+  arena_t arena = { NULL, NULL };
+  group_t group;
+  char line[100];
+  // test 1: words, redirection without whitespace and pipelines
+  strcpy(line, "  ls -l\tredirect.c>a.txt & cat a | wc -l \n");
+  assert(parse_line(&arena, line, &group) == 0);
+  assert(group.pipeline_count == 2);
+  command_t * cmd = group.first->first;
+  assert(cmd->argc == 3 && strcmp(cmd->argv[2], "redirect.c") == 0);
+  assert(cmd->argv[3] == NULL && strcmp(cmd->out_path, "a.txt") == 0);
+  assert(group.first->next->stage_count == 2 && !group.background);
+  cmd = group.first->next->first->next;
+  assert(strcmp(cmd->argv[0], "wc") == 0 && strcmp(cmd->argv[1], "-l") == 0);
+  // test 2: empty pipelines are skipped
+  arena_reset(&arena);
+  strcpy(line, "& ls &&");
+  assert(parse_line(&arena, line, &group) == 0);
+  assert(group.pipeline_count == 1 && group.background);
+  // test 3: syntax errors
+  char * invalid[] = { "ls >", "> a", "ls > a b", "ls > a > b", "| ls", "ls |", "ls | | wc" };
+  for(int i=0; i<sizeof(invalid)/sizeof(invalid[0]); i++){
+    arena_reset(&arena);
+    strcpy(line, invalid[i]);
+    assert(parse_line(&arena, line, &group) == -1);
+  }
+  // test 4: more arguments than one argv allocation
+  arena_reset(&arena);
+  strcpy(line, "echo 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17");
+  assert(parse_line(&arena, line, &group) == 0);
+  assert(group.first->first->argc == 18);
+  assert(strcmp(group.first->first->argv[17], "17") == 0);
+  // test 5: input, append and error redirections
+  arena_reset(&arena);
+  strcpy(line, "sort<in>>out 2>&1 | wc 2>err");
+  assert(parse_line(&arena, line, &group) == 0);
+  cmd = group.first->first;
+  assert(cmd->argc == 1 && strcmp(cmd->in_path, "in") == 0);
+  assert(strcmp(cmd->out_path, "out") == 0 && cmd->out_append && cmd->err_to_out);
+  cmd = cmd->next;
+  assert(cmd->argc == 1 && strcmp(cmd->err_path, "err") == 0 && !cmd->err_append);
+  arena_reset(&arena);
+  strcpy(line, "echo 2 a2>b");
+  assert(parse_line(&arena, line, &group) == 0);
+  cmd = group.first->first;
+  assert(cmd->argc == 3 && strcmp(cmd->argv[2], "a2") == 0 && cmd->err_path == NULL);
+  char * invalid_redirections[] = { "ls < a < b", "ls 2> a 2>&1", "ls >> ", "ls < a b", "ls > < a" };
+  for(int i=0; i<sizeof(invalid_redirections)/sizeof(invalid_redirections[0]); i++){
+    arena_reset(&arena);
+    strcpy(line, invalid_redirections[i]);
+    assert(parse_line(&arena, line, &group) == -1);
+  }
+  arena_reset(&arena);
+  free(arena.head);
+  printf("parse: all tests passed\n");
+  return 0;
+}
+#endif //TEST
@@ -0,0 +1,58 @@
+/**
+ * @file   parse.h
+ * @author O Hung Lun <hunglun.o@gmail.com>
+ *
+ * @brief  Single-pass command line parser
+ *
+ * A line is parsed into a group of pipelines separated by '&'. Each
+ * pipeline is a list of commands separated by '|', each with optional
+ * redirections '<', '>', '>>', '2>', '2>>' and '2>&1'. Words are not copied:
+ * the line is split in place, and every node lives in an arena which is
+ * reset before the next line is parsed.
+ */
+#ifndef parse_h
+#define parse_h
+
+#include <stddef.h> // size_t
+
+typedef struct arena_block {
+  struct arena_block * next;
+  size_t used;
+  size_t size;
+  char data[];
+} arena_block_t;
+
+typedef struct arena {
+  arena_block_t * head; // block currently allocated from
+  void * last;          // last allocation, it can grow in place
+} arena_t;
+
+typedef struct command {
+  char ** argv;          // program arguments, ending with NULL
+  int argc;
+  char * in_path;        // file after '<', or NULL
+  char * out_path;       // file after '>' or '>>', or NULL
+  char * err_path;       // file after '2>' or '2>>', or NULL
+  int out_append;        // '>>' instead of '>'
+  int err_append;        // '2>>' instead of '2>'
+  int err_to_out;        // '2>&1': stderr goes where stdout goes
+  struct command * next; // next stage of the pipeline
+} command_t;
+
+typedef struct pipeline {
+  command_t * first;      // first stage
+  int stage_count;
+  struct pipeline * next; // next pipeline of the '&' group
+} pipeline_t;
+
+typedef struct group {
+  pipeline_t * first;
+  int pipeline_count;
+  int background;         // the line ends with '&'
+} group_t;
+
+void * arena_alloc(arena_t * arena, size_t size);
+void arena_reset(arena_t * arena);
+int parse_line(arena_t * arena, char * line, group_t * group);
+
+#endif //parse_h
@@ -0,0 +1,142 @@
+/**
+ * @file   profile.c
+ * @author O Hung Lun <hunglun.o@gmail.com>
+ *
+ * @brief  Resource usage of commands: time builtin and WISH_PROFILE summary
+ *
+ * Usage of each process comes from wait4(). In profile mode, totals of
+ * every command are kept, together with the slowest commands; the summary
+ * is printed to stderr when the shell exits.
+ */
+#include <stdio.h> // fprintf
+#include <stdlib.h> // atexit
+#include <string.h> // memmove
+#include "profile.h"
+
+#define PROFILE_SLOWEST 10 // commands listed in the summary
+
+typedef struct slow_command {
+  double real;
+  char * name;
+} slow_command_t;
+
+static int g_enabled = 0;
+static long g_command_count = 0;
+static usage_t g_total;
+static slow_command_t g_slowest[PROFILE_SLOWEST]; // slowest first
+static int g_slowest_count = 0;
+/**
+ * seconds elapsed since start on the monotonic clock
+ *
+ * @param start
+ *
+ * @return seconds
+ */
+double elapsed_since(struct timespec * start){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+/**
+ * add resource usage of one reaped process
+ *
+ * @param usage
+ * @param ru : reported by wait4
+ */
+void add_rusage(usage_t * usage, struct rusage * ru){
+  usage->user += ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+  usage->sys += ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+  if (ru->ru_maxrss > usage->maxrss) usage->maxrss = ru->ru_maxrss;
+  usage->nvcsw += ru->ru_nvcsw;
+  usage->nivcsw += ru->ru_nivcsw;
+}
+/**
+ * print usage of a command on stderr, for the time builtin
+ *
+ * @param usage
+ */
+void print_usage(usage_t * usage){
+  fprintf(stderr, "real %.3fs user %.3fs sys %.3fs maxrss %ldKB ctxsw %ld+%ld\n",
+          usage->real, usage->user, usage->sys, usage->maxrss,
+          usage->nvcsw, usage->nivcsw);
+}
+/**
+ * print the summary of the profile on stderr
+ *
+ * Registered with atexit by profile_enable.
+ */
+static void profile_report(void){
+  fprintf(stderr, "wish profile: %ld commands, %.3fs real, %.3fs user, "
+          "%.3fs sys, %.3fs in fork/exec, %ld+%ld ctxsw\n",
+          g_command_count, g_total.real, g_total.user, g_total.sys,
+          g_total.spawn, g_total.nvcsw, g_total.nivcsw);
+  for(int i=0; i<g_slowest_count; i++)
+    fprintf(stderr, "%10.3fs  %s\n", g_slowest[i].real, g_slowest[i].name);
+}
+/**
+ * turn on profile mode, the summary is printed at exit
+ */
+void profile_enable(void){
+  if (g_enabled) return;
+  g_enabled = 1;
+  atexit(profile_report);
+}
+/**
+ * @return 1 in profile mode, otherwise 0
+ */
+int profile_enabled(void){
+  return g_enabled;
+}
+/**
+ * command text of pipeline, with its stages joined by " | "
+ *
+ * @param pipeline
+ *
+ * @return allocated string
+ */
+char * pipeline_name(pipeline_t * pipeline){
+  size_t len = 1;
+  for(command_t * cmd = pipeline->first; cmd != NULL; cmd = cmd->next)
+    for(int i=0; i<cmd->argc; i++) len += strlen(cmd->argv[i]) + 3;
+  char * name = malloc(len);
+  char * end = name;
+  for(command_t * cmd = pipeline->first; cmd != NULL; cmd = cmd->next){
+    if (cmd != pipeline->first) end = stpcpy(end, "| ");
+    for(int i=0; i<cmd->argc; i++){
+      end = stpcpy(end, cmd->argv[i]);
+      end = stpcpy(end, " ");
+    }
+  }
+  if (end != name) end[-1] = '\0'; /*  drop the last space */
+  else *end = '\0';
+  return name;
+}
+/**
+ * add the usage of a finished command to the profile
+ *
+ * Only the slowest commands keep their text, so memory does not grow
+ * with the length of the script.
+ *
+ * @param usage
+ * @param pipeline : the command.
+ * @param name : text of the command, or NULL to build it from pipeline.
+ */
+void profile_record(usage_t * usage, pipeline_t * pipeline, char * name){
+  g_command_count++;
+  g_total.real += usage->real;
+  g_total.user += usage->user;
+  g_total.sys += usage->sys;
+  g_total.spawn += usage->spawn;
+  if (usage->maxrss > g_total.maxrss) g_total.maxrss = usage->maxrss;
+  g_total.nvcsw += usage->nvcsw;
+  g_total.nivcsw += usage->nivcsw;
+
+  int i = g_slowest_count; /*  insertion point, slowest first */
+  while(i > 0 && g_slowest[i - 1].real < usage->real) i--;
+  if (i == PROFILE_SLOWEST) return;
+  if (g_slowest_count == PROFILE_SLOWEST) free(g_slowest[--g_slowest_count].name);
+  memmove(&g_slowest[i + 1], &g_slowest[i], sizeof(slow_command_t) * (g_slowest_count - i));
+  g_slowest_count++;
+  g_slowest[i].real = usage->real;
+  g_slowest[i].name = (name != NULL) ? strdup(name) : pipeline_name(pipeline);
+}
@@ -0,0 +1,32 @@
+/**
+ * @file   profile.h
+ * @author O Hung Lun <hunglun.o@gmail.com>
+ *
+ * @brief  Resource usage of commands: time builtin and WISH_PROFILE summary
+ */
+#ifndef profile_h
+#define profile_h
+
+#include <sys/resource.h> // struct rusage
+#include <time.h> // struct timespec
+#include "parse.h" // pipeline_t
+
+typedef struct usage {
+  double real;   // wall clock seconds, from spawn to the last reaped process
+  double user;   // user CPU seconds of all processes
+  double sys;    // system CPU seconds of all processes
+  double spawn;  // seconds spent in the shell creating the processes
+  long maxrss;   // largest resident set size, in kilobytes
+  long nvcsw;    // voluntary context switches
+  long nivcsw;   // involuntary context switches
+} usage_t;
+
+double elapsed_since(struct timespec * start);
+void add_rusage(usage_t * usage, struct rusage * ru);
+void print_usage(usage_t * usage);
+void profile_enable(void);
+int profile_enabled(void);
+void profile_record(usage_t * usage, pipeline_t * pipeline, char * name);
+char * pipeline_name(pipeline_t * pipeline);
+
+#endif //profile_h
@@ -3,147 +3,93 @@
  * @author O Hung Lun <hunglun.o@gmail.com>
  * @date   Thu Dec 12 22:11:32 2019
  * 
- * @brief  Support Redirection of Standard Output to File
- * 
+ * @brief  Support Redirection of Standard Streams to Files
  * 
+ * Output files are truncated ('>') or appended to ('>>'). Streams are
+ * applied in order: stdin, stdout, then stderr, so "2>&1" follows the
+ * redirection of stdout wherever it appears on the line.
  */
-#include <string.h>
-#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h> // O_WRONLY
-#include <stdlib.h>
-#include <assert.h>
 #include "redirect.h"
+#define REDIRECT_MODE 00600
 /** 
- * convert a string into an array using whitespace as delimiter
- *
- * Note: create a function that replace complex whitespace with single whitespace.
- *       free dest after use. TODO provide a convenient method to free dest.
- * @param pdest 
- * @param src 
- * 
- * @return array size
- */
-int convert_string_to_array(char *** pdest, char * src){
-  // can i dynamically allocate memory to dest? Yes
-  int token_count;
-  int srclen;
-  char * line;
-  char * orig; // remember start of allocated memory before using strsep
-  char ** dest;
-  
-  // INITIALISE
-  srclen = strlen(src);
-  orig = line = malloc(srclen+1);
-  // FIRST PASS OVER SRC TO DETERMINE THE SIZE OF DEST.
-  token_count = 0;
-  strcpy(line, src);
-  while(line!=NULL){
-    (void)strsep(&line," ");
-    token_count++;
-  }
-  // PREPARE FOR SECOND PASS
-  dest = malloc(token_count * sizeof(char *));
-  line = orig;
-  
-  // SECOND PASS TO POPULATE DEST.
-  token_count = 0; // reset token count      
-  strcpy(line, src); // overwrite line with src again.
-  while(line!=NULL){
-    char * token = strsep(&line," ");
-    dest[token_count] = malloc(strlen(token) + 1);
-    strcpy(dest[token_count], token);
-    token_count++;
-  }
-  // CLEAN UP
-  *pdest = dest;
-  free(orig);
-  return token_count;
-}
-/** 
- * Store substring in output path after '>' sign.
+ * open flags for an output file
  * 
- * @param output_path contains pre-allocated memory, enough to hold output path shorter than line.
- * @param line 
- * @param sign is '&'
+ * @param append 
  * 
- * @return 
+ * @return flags for open
  */
-int get_output_path(char ** output_path, char * line, char * sign){
-  assert(strlen(sign) == 1); // assert that the sign is a single character.
-  for(int i=0;i<strlen(line);i++){ // iterate over line
-    if(line[i] == *sign) {
-      strcpy(*output_path, &line[i+1]); // i+1 will not go out of bound, because there is NULL character after sign.
-      return 0;
-    }
-  }
-  return -1;
+static int output_flags(int append){
+  return O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
 }
 /** 
- * redirect standard output to file
+ * redirect the standard streams of a spawned process to files
+ *
+ * Only the calling process' spawn actions are changed; the files are
+ * opened in the new process between fork and exec, so the shell never
+ * touches its own file descriptors and concurrent jobs can each redirect.
+ * Failure to open a file makes posix_spawn fail.
  * 
- * @param path 
+ * @param actions : added after the pipe actions, so a file wins over a pipe.
+ * @param cmd 
  * 
  * @return 0 if success, otherwise return -1
  */
-int redirect_stdout_to_file(char * path){
-  //remove heading whitespace
-  while((*path) == ' ') path++;
-  int filefd = open(path, O_WRONLY|O_CREAT, 00600);
-  if (filefd == -1) return -1;
-  close(1);
-  dup(filefd);
+int redirect_spawned(posix_spawn_file_actions_t * actions, command_t * cmd){
+  if (cmd->in_path != NULL &&
+      posix_spawn_file_actions_addopen(actions, STDIN_FILENO, cmd->in_path,
+                                       O_RDONLY, 0) != 0) return -1;
+  if (cmd->out_path != NULL &&
+      posix_spawn_file_actions_addopen(actions, STDOUT_FILENO, cmd->out_path,
+                                       output_flags(cmd->out_append), REDIRECT_MODE) != 0)
+    return -1;
+  if (cmd->err_path != NULL &&
+      posix_spawn_file_actions_addopen(actions, STDERR_FILENO, cmd->err_path,
+                                       output_flags(cmd->err_append), REDIRECT_MODE) != 0)
+    return -1;
+  if (cmd->err_to_out &&
+      posix_spawn_file_actions_adddup2(actions, STDOUT_FILENO, STDERR_FILENO) != 0)
+    return -1;
   return 0;
 }
 /** 
- * remove leading and trailing whitespaces in path
+ * redirect the standard streams of the shell itself to files
+ *
+ * Only used when the shell is about to be replaced by a command. Every
+ * file is opened before any stream is changed, so if one cannot be
+ * opened the shell is left as it was and can run the command as usual.
  * 
- * @param string 
+ * @param cmd 
+ * 
+ * @return 0 if success, otherwise return -1
  */
-void trim_string(char ** string){
-  // move pointer past leading whitespaces
-  int sz = strlen(*string);
-  for(int i=0; i<sz; i++){
-    if((*string)[0] != ' ') {
-#ifdef TEST
-      printf("%s, %c, %d\n", *string, (*string)[0], i);
-#endif //TEST
-      break;      
+int redirect_in_shell(command_t * cmd){
+  char * paths[3] = {cmd->in_path, cmd->out_path, cmd->err_path};
+  int flags[3] = {O_RDONLY, output_flags(cmd->out_append), output_flags(cmd->err_append)};
+  int fds[3] = {-1, -1, -1};
+  int fd, i;
+  for(i=0; i<3; i++){
+    if (paths[i] == NULL) continue;
+    fd = open(paths[i], flags[i] | O_CLOEXEC, REDIRECT_MODE);
+    /*  keep clear of the standard streams, which are replaced below */
+    if (fd != -1 && fd <= STDERR_FILENO) {
+      fds[i] = fcntl(fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+      close(fd);
+    } else {
+      fds[i] = fd;
     }
-    (*string)++;
+    if (fds[i] == -1) break;
   }
-  // replace trailing whitespaces with NULL terminator
-  for(int i=strlen(*string)-1; 0 < i; i--){
-    if((*string)[i] != ' ') break;
-    (*string)[i] = '\0';
+  if (i < 3) {
+    for(i=0; i<3; i++) if (fds[i] != -1) close(fds[i]);
+    return -1;
   }
-}
-#ifdef TEST
-int main(int argc, char *argv[]){
-  // test 1: valid redirection
-  
-  char * line;
-  char * path = malloc(255); // 255 is the maximum filename length of EXT4 filesystem.
-  char * sign = "-";
-  int result;
-  // test 1
-  line = "ls  redirect.c - a.txt ";
-  result = get_output_path(&path, line, sign);
-  assert(result == 0);
-  (void)trim_string(&path);
-  assert(strcmp(path, "a.txt") == 0);
-  // test 2
-  line = "ls redirect.c-a.txt ";
-  result = get_output_path(&path, line, sign);
-  assert(result == 0);
-  (void)trim_string(&path);
-  assert(strcmp(path, "a.txt") == 0);
-  // test 3
-  char * str = malloc(100);
-  strcpy(str, "          echo test variable whitespace!           ");
-  (void)trim_string(&str);
-  assert(strcmp(str, "echo test variable whitespace!") == 0);
-  
+  for(i=0; i<3; i++){
+    if (fds[i] == -1) continue;
+    if (dup2(fds[i], i) == -1) return -1; /*  i is STDIN_FILENO + i */
+    close(fds[i]);
+  }
+  if (cmd->err_to_out && dup2(STDOUT_FILENO, STDERR_FILENO) == -1) return -1;
   return 0;
 }
-#endif 
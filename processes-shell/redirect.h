@@ -3,16 +3,17 @@
  * @author O Hung Lun <hunglun.o@gmail.com>
  * @date   Thu Dec 12 22:11:02 2019
  * 
- * @brief  Support Redirection of Standard Output to File
+ * @brief  Support Redirection of Standard Streams to Files
  * 
  * 
  */
 #ifndef redirect_h
 #define redirect_h
 
-int convert_string_to_array(char *** pdest, char * src);
-int get_output_path(char ** path, char * line, char * sign);
-int redirect_stdout_to_file(char * path);
-void trim_string(char ** str);
+#include <spawn.h> // posix_spawn_file_actions_t
+#include "parse.h" // command_t
+
+int redirect_spawned(posix_spawn_file_actions_t * actions, command_t * cmd);
+int redirect_in_shell(command_t * cmd);
 
 #endif //redirect_h
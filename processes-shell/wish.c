@@ -4,111 +4,210 @@
  * @date   Thu Dec 12 22:11:44 2019
  *
  * @brief  a toy shell implementation that supports system command execution,
- * script, redirection and parallel execution. Requirement is described in
+ * script, redirection, pipelines, parallel execution and command profiling. Requirement is described in
  * github.com/remzi-arpacidusseau/ostep-projects/tree/master/processes-shell
  *
  */
 /* Standard headers */
-#include <sys/wait.h> /* wait */
+#define _GNU_SOURCE /*  pipe2 */
+#include <sys/wait.h> /* wait4 */
 #include <stdio.h> /* printf */
 #include <stdlib.h> /* fopen */
 #include <string.h> /* strsep, strcat */
 #include <unistd.h> /* execv */
 #include <assert.h> /* assert */
 #include <errno.h> /*  show last error number */
+#include <fcntl.h> /*  O_CLOEXEC */
+#include <spawn.h> /*  posix_spawn */
+#include <sys/stat.h> /*  fstat */
+#include <signal.h> /*  sigaction */
 /* relative headers */
-#include "redirect.h" /*  redirection, parse_line_argv */
+#include "redirect.h" /*  redirection */
+#include "parse.h" /*  parse_line */
+#include "profile.h" /*  time builtin, WISH_PROFILE */
+#include "history.h" /*  history_open */
+#include "lineedit.h" /*  lineedit_read */
 #define SEARCH_PATH_SIZE 100
 #define MAX_PATH_LENGTH 255
-#define MAX_PROCESS_CNT 255
-#define MAX_CMD_ARG_LEN 10
+#define PATH_CACHE_SIZE 64 /*  buckets, each one a linked list */
+#define MAX_BACKGROUND_JOBS 64
+/* Types */
+typedef struct path_entry {
+  char * basename;
+  char * path;
+  struct path_entry * next;
+} path_entry_t;
+typedef struct job {
+  pipeline_t * pipeline;
+  pid_t * pids;  /*  one process per pipeline stage, -1 if it did not start */
+  int pid_count;
+  int running;   /*  processes not reaped yet */
+  int status;    /*  exit code of the last stage, 127 if it did not start */
+  int timed;     /*  prefixed by the time builtin */
+  struct timespec start;
+  usage_t usage; /*  resources used by all processes of the job */
+  char * text;   /*  command text of a background job, otherwise NULL */
+} job_t;
+typedef enum step_state {
+  STEP_WAITING, /*  dependencies not finished yet */
+  STEP_RUNNING,
+  STEP_DONE,
+  STEP_FAILED,  /*  a job exited non-zero, or the line is invalid */
+  STEP_SKIPPED, /*  a dependency failed */
+} step_state_t;
+typedef struct step {
+  char * name;           /*  set by "#step:", or NULL */
+  group_t group;         /*  the command line */
+  int barrier;           /*  a built-in command: runs alone, in script order */
+  int waiting;           /*  dependencies which have not succeeded yet */
+  int * dependents;      /*  steps naming this one in "#after:" */
+  int dependent_count;
+  step_state_t state;
+  pipeline_t * next;     /*  next pipeline of group to start */
+  int running;           /*  jobs of the step not terminated yet */
+  int failed;            /*  one of its jobs exited non-zero */
+} step_t;
+typedef struct dag {
+  step_t * steps;        /*  in script order */
+  int count;
+  int capacity;
+  char * name;           /*  annotations for the next command line */
+  int * after;
+  int after_count;
+  int invalid;           /*  an annotation of the next command is invalid */
+  int * ready;           /*  queue of steps whose dependencies succeeded */
+  int ready_head;
+  int ready_tail;
+  int end;               /*  steps before end belong to the running segment */
+} dag_t;
 /* Global variables */
+extern char **environ; /*  passed on to every spawned program */
 char *g_paths[SEARCH_PATH_SIZE];
 FILE * g_stream = NULL;
+path_entry_t * g_path_cache[PATH_CACHE_SIZE]; /* basename -> resolved path */
+int g_max_jobs = 0; /*  parallel jobs running at once, set by -j */
+arena_t g_arena; /*  parse tree of the current line */
+int g_dag_mode = 0; /*  -d: run the script as a dependency graph */
+int g_status = 0; /*  exit code of the last command line, that of a batch script */
+dag_t g_dag;
+job_t g_background[MAX_BACKGROUND_JOBS]; /*  job number is index + 1, free if text is NULL */
+history_t g_history; /*  lines typed on a terminal */
 /* Function prototypes */
-int redirect_stdout_to_valid_file(char ** line);
-int execute_processes_in_parallel(char ** line);
+int execute_parallel(group_t * group);
 void print_error_msg(void);
-int is_builtin_cmd(char * line);
+int is_builtin_cmd(command_t * cmd);
+int list_jobs(command_t * cmd);
+int wait_jobs(command_t * cmd);
+int dag_count_failed(int end);
 /**
  * exit is a built-in command to exit the shell.
  *
- * it does not accept argument.
+ * it does not accept argument. In -d mode it is a barrier, so every step
+ * before it has finished, and the shell fails if one of them did.
  *
- * @param line
+ * @param cmd
  *
- * @return 0 if line starts with 'exit'. Otherwise -1.
+ * @return 0 if the program is 'exit'. Otherwise -1.
  */
-int exit_shell(char * line){
-  if (strlen(line) == 4 && strcmp(line, "exit") == 0) exit(0);
-  if (strncmp(line, "exit", 4) == 0){
-    print_error_msg(); /*  it is an error to pass argument to exit */
-    return 0;
-  }
-  else{
-    return -1;
-  }
+int exit_shell(command_t * cmd){
+  if (strcmp(cmd->argv[0], "exit") != 0) return -1;
+  if (cmd->argc == 1 && g_dag_mode)
+    exit(dag_count_failed(g_dag.end - 1) == 0 ? 0 : EXIT_FAILURE); /*  the barrier is step end - 1 */
+  if (cmd->argc == 1) exit(0);
+  print_error_msg(); /*  it is an error to pass argument to exit */
+  return 0;
 }
 
 /**
- * get_path_for_basename
- * Search for basename in g_paths
+ * Hash basename into a bucket of g_path_cache
  *
  * @param basename
  *
- * @return full path of a match. Return NULL if no match is found.
+ * @return bucket index
  */
-int get_path_for_basename(char **path, char * basename){
-  int i=0;
-  while(g_paths[i]!=NULL){
-    /*  control copy size.  2 is for "/" and null terminator. */
-    strncpy(*path, g_paths[i], MAX_PATH_LENGTH - strlen(basename) - 2);
-    (void)strcat(*path, "/");
-    (void)strcat(*path, basename);
-    if (access(*path, X_OK) == 0){
-      return 0; /*  found! */
+unsigned int hash_basename(char * basename){
+  unsigned int hash = 5381;
+  for(char * c = basename; *c != 0; c++) hash = hash * 33 + (unsigned char)*c;
+  return hash % PATH_CACHE_SIZE;
+}
+/**
+ * Forget every resolved path.
+ *
+ * Called when the search path changes, or when a cached path could not
+ * be executed any more (the program was removed or moved).
+ */
+void invalidate_path_cache(void){
+  for(int i=0; i<PATH_CACHE_SIZE; i++){
+    while(g_path_cache[i] != NULL){
+      path_entry_t * entry = g_path_cache[i];
+      g_path_cache[i] = entry->next;
+      free(entry->basename);
+      free(entry->path);
+      free(entry);
     }
-    i++;
   }
-  return -1;
 }
 /**
- * Convert str to array of string separated by " ". The last entry is set to NULL.
+ * get_path_for_basename
+ * Search for basename in g_paths
  *
- * If the size of array exceeds n, the content is truncated to n.
- * Last entry in array is NULL.
+ * Successful lookups are remembered in g_path_cache, so that access() is
+ * only called for the first use of a command. Failed lookups are not
+ * cached: the program may be installed later.
  *
- * @param args : args is allocated memory in this function.
- * @param str
- * @param n : max size of array args
+ * @param basename
  *
- * @return size of args
+ * @return full path of a match (owned by the cache). Return NULL if no match is found.
  */
-int convert_whitespc_delimited_string_to_array(char ***args, char * str, int n){
-  char * line = strdup(str);
-  int i = 0;
-  *args =  malloc(sizeof(char *) * n);
-  while(line!=NULL && i < n-1){
-    (*args)[i] = strsep(&line, " ");
+char * get_path_for_basename(char * basename){
+  unsigned int bucket = hash_basename(basename);
+#ifndef NO_PATH_CACHE
+  for(path_entry_t * entry = g_path_cache[bucket]; entry != NULL; entry = entry->next){
+    if (strcmp(entry->basename, basename) == 0) return entry->path;
+  }
+#endif
+  char path[MAX_PATH_LENGTH];
+  int i=0;
+  while(g_paths[i]!=NULL){
+    /*  control copy size: longer candidates are truncated and fail access(). */
+    snprintf(path, MAX_PATH_LENGTH, "%s/%s", g_paths[i], basename);
+    if (access(path, X_OK) == 0){
+      path_entry_t * entry = malloc(sizeof(path_entry_t)); /*  found! */
+      entry->basename = strdup(basename);
+      entry->path = strdup(path);
+      entry->next = g_path_cache[bucket];
+      g_path_cache[bucket] = entry;
+      return entry->path;
+    }
     i++;
-  }   /*  parse line into myargs array. */
-  (*args)[i] = NULL; /* execv expects myargs array to end with NULL. */
-  return i;
+  }
+  return NULL;
 }
 /**
- * Execute script or system commands in a new process
+ * Start script or system commands in a new process
+ *
+ * posix_spawn creates the process without copying the page tables of the
+ * shell (glibc uses CLONE_VM|CLONE_VFORK). Standard streams of the new
+ * process are set up by actions, so the shell never touches its own fds.
  *
- * This function is called after a new process is forked.
- * @param line
+ * @param pid : set to the pid of the new process.
+ * @param path : resolved by get_path_for_basename, may be NULL.
+ * @param myargs
+ * @param actions : redirections applied between clone and exec.
+ *
+ * @return 0 if the program is running, otherwise -1 (error is printed).
  */
-void execute_command_after_fork(char * line){
-  char **myargs;
-  char * found_path = malloc(MAX_PATH_LENGTH);  /* it will not be freed. */
-  (void)convert_whitespc_delimited_string_to_array(&myargs, line, MAX_CMD_ARG_LEN);
-  (void)get_path_for_basename(&found_path, myargs[0]);
-  (void)execv(found_path, myargs); /*  line is program arguments */
+int spawn_command(pid_t * pid, char * path, char ** myargs,
+                  posix_spawn_file_actions_t * actions){
+  int rc = (path == NULL) ? ENOENT :
+    posix_spawn(pid, path, actions, NULL, myargs, environ);
+  if (rc == 0) return 0;
+  /*  ENOENT also comes from a '<' file which does not exist: only a
+      program which was removed or moved makes the cache stale. */
+  if (rc == ENOENT && path != NULL && access(path, X_OK) != 0)
+    invalidate_path_cache();
   print_error_msg();
-  exit(0);
+  return -1;
 }
 /**
  * print_error_msg
@@ -120,22 +219,17 @@ void print_error_msg(void){
 /**
  * cd is a built-in command to change directory.
  *
- * @param line : it is modified as side effect, if line is prefixed by 'cd'
+ * @param cmd
  *
- * @return 0 if line starts with 'cd'. Otherwise -1.
+ * @return 0 if the program is 'cd'. Otherwise -1.
  */
-int change_directory(char * line){
-  if (strncmp(line, "cd", 2) == 0) {
-    char * cmd = strsep(&line, " "); /*  cmd == cd           */
-    char * dest = strsep(&line, " ");
-    if(line != NULL /* does not expect a second argument. */
-       || chdir(dest) == -1){ /* change directory fails */
-      print_error_msg();
-    }
-    return 0;
-  }else{
-    return -1;
+int change_directory(command_t * cmd){
+  if (strcmp(cmd->argv[0], "cd") != 0) return -1;
+  if(cmd->argc != 2 /* expects exactly one argument. */
+     || chdir(cmd->argv[1]) == -1){ /* change directory fails */
+    print_error_msg();
   }
+  return 0;
 }
 /**
  * path is a built-in command to reset search path to given argument.
@@ -143,23 +237,21 @@ int change_directory(char * line){
  * If no argument is given, search path will be empty and
  * all subsequent system commands (except for bash script) will return error.
  *
- * @param line : line is modified as a side effect.
+ * @param cmd
  *
- *  @return 0 if line starts with 'path'. Otherwise -1.
+ *  @return 0 if the program is 'path'. Otherwise -1.
  */
-int set_path(char * line){
-  /*  does it start with 'path'? */
-  if (strncmp(line, "path", 4) != 0) return -1;
-  (void)strsep(&line, " "); /*  move cursor to the first argument. */
+int set_path(command_t * cmd){
+  if (strcmp(cmd->argv[0], "path") != 0) return -1;
+  invalidate_path_cache();
   /*  empty g_paths before assignment */
   for(int i=0; i<SEARCH_PATH_SIZE; i++) {
     if(g_paths[i]!=NULL) {
       free(g_paths[i]); /*  free path */
       g_paths[i]=NULL;
     }
-    if(line!=NULL){
-      char *p = strsep(&line, " ");
-      g_paths[i] = strdup(p);
+    if(i + 1 < cmd->argc){
+      g_paths[i] = strdup(cmd->argv[i + 1]);
     }
   }
   return 0;
@@ -167,83 +259,790 @@ int set_path(char * line){
 /**
  * parse for built-in command
  *
- * @param line : modified as a side effect, if it is a built-in command.
+ * @param cmd
  *
  * @return 0 if it is built-in command, otherwise, -1.
  */
-int is_builtin_cmd(char * line){
+int is_builtin_cmd(command_t * cmd){
   /*  parse exit, path and cd commands */
-  return  (set_path(line) == 0         ||
-	   change_directory(line) == 0 ||
-	   exit_shell(line) == 0)? 0 : -1;
+  return  (set_path(cmd) == 0         ||
+	   change_directory(cmd) == 0 ||
+	   exit_shell(cmd) == 0 ||
+	   list_jobs(cmd) == 0 ||
+	   wait_jobs(cmd) == 0)? 0 : -1;
+}
+/**
+ * tell a built-in command by its name, without running it
+ *
+ * @param name
+ *
+ * @return 1 for exit, path, cd, jobs and wait, otherwise 0.
+ */
+int is_builtin_name(char * name){
+  return strcmp(name, "cd") == 0 || strcmp(name, "path") == 0 ||
+    strcmp(name, "exit") == 0 || strcmp(name, "jobs") == 0 ||
+    strcmp(name, "wait") == 0;
+}
+/**
+ * Convert a status reported by waitpid into a shell exit code.
+ *
+ * @param status
+ *
+ * @return exit code of the process, or 128 + signal number if it was killed.
+ */
+int get_exit_code(int status){
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+/**
+ * Report the resources used by a job whose processes have all terminated.
+ *
+ * @param job
+ */
+void finish_job(job_t * job){
+  if (job->timed) print_usage(&job->usage);
+  if (profile_enabled()) profile_record(&job->usage, job->pipeline, job->text);
+}
+/**
+ * Record the exit of process i of job.
+ *
+ * Only job is written and no memory is allocated, so this is also safe
+ * in the SIGCHLD handler.
+ *
+ * @param job
+ * @param i : index of the process in job->pids.
+ * @param status : reported by wait4.
+ * @param ru : resources used by the process, reported by wait4.
+ */
+void record_exit(job_t * job, int i, int status, struct rusage * ru){
+  job->pids[i] = -1;
+  job->running--;
+  if (i == job->pid_count - 1) job->status = get_exit_code(status);
+  add_rusage(&job->usage, ru);
+  if (job->running == 0) job->usage.real = elapsed_since(&job->start);
+}
+/**
+ * Record that one process of job has terminated.
+ *
+ * @param job
+ * @param pid : the terminated process.
+ * @param status : reported by wait4.
+ * @param ru : resources used by the process, reported by wait4.
+ *
+ * @return 0 if pid belongs to job, otherwise -1.
+ */
+int reap_job_process(job_t * job, pid_t pid, int status, struct rusage * ru){
+  for(int i=0; i<job->pid_count; i++){
+    if (job->pids[i] != pid) continue;
+    record_exit(job, i, status, ru);
+    if (job->running == 0) finish_job(job);
+    return 0;
+  }
+  return -1;
 }
 /**
- * spawn new processes to support parallel execution
+ * Wait until every process of job has terminated.
  *
- * @param line : if parallel execution is valid, line become empty.
+ * @param job
  *
- * @return 0 if  valid parallel execution or  no parallel execution.
- *         -1 if  invalid parallel execution.
+ * @return exit code of the job.
  */
-int execute_processes_in_parallel(char ** line){
-  if (strchr(*line, '&') == NULL) return 0; /*  no parallel commands */
-  /*  let's determine if it is valid parallel execution command. */
-  if (strlen(*line) == 1) {  /* just '&' */
-    *line[0] = 0; /*  consume line */
-    return 0;  /*  '&' is valid. */
+int wait_job(job_t * job){
+  for(int i=0; i<job->pid_count; i++){
+    int status;
+    struct rusage ru;
+    pid_t pid = job->pids[i];
+    if (pid != -1 && wait4(pid, &status, 0, &ru) == pid)
+      reap_job_process(job, pid, status, &ru);
   }
-  if ((*line)[strlen(*line) - 1] != '&')
-    strcat(*line, " &"); /*  append & to make  a&b command truly parallel  */
+  return job->status;
+}
+/**
+ * Start a pipeline "cmd1 | cmd2 | ... | cmdN" without waiting for it.
+ *
+ * A single command is a pipeline of one stage. All stages are spawned
+ * before any of them is waited for, so they run concurrently. Stage i
+ * reads the pipe written by stage i-1 and writes the pipe read by stage
+ * i+1. Pipes are created close-on-exec, so a stage only keeps the ends
+ * dup'ed onto its stdin/stdout, and the parent closes each end as soon as
+ * the stages that need it exist; a reader therefore gets EOF when its
+ * writer exits.
+ *
+ * A pipeline made of one built-in command runs immediately in the shell,
+ * without starting any process. A pipeline prefixed by the time builtin
+ * reports its resource usage when it terminates; timing a built-in
+ * command is an error, as it uses no process to report on.
+ *
+ * @param pipeline
+ * @param job : filled in with the spawned processes.
+ */
+void start_job(pipeline_t * pipeline, job_t * job){
+  job->pipeline = pipeline;
+  job->pids = NULL;
+  job->pid_count = 0;
+  job->running = 0;
+  job->status = 0;
+  job->timed = 0;
+  job->text = NULL;
+  memset(&job->usage, 0, sizeof(usage_t));
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  if (strcmp(pipeline->first->argv[0], "time") == 0){
+    if (pipeline->first->argc == 1 || is_builtin_name(pipeline->first->argv[1])){
+      print_error_msg(); /*  nothing to time: built-ins start no process */
+      return;
+    }
+    pipeline->first->argv++;
+    pipeline->first->argc--;
+    job->timed = 1;
+  }
+  if (pipeline->stage_count == 1 && is_builtin_cmd(pipeline->first) == 0) return;
 
-  /*  create new process for each & sign. */
-  char * orig = strsep(line, "&");
-  char * prev = orig; /*  remember the last token */
-  int children_pid[MAX_PROCESS_CNT]; /*  TODO make the size  more flexible */
-  int children_count = 0;
-  while(*line != NULL){
-    int pid = fork();
-    children_pid[children_count++]=pid;
-    if (pid == 0){
-      *line = strdup(prev);
+  job->pids = malloc(sizeof(pid_t) * pipeline->stage_count);
+  job->pid_count = pipeline->stage_count;
+  job->status = 127;
+  int read_fd = -1; /*  read end of the previous pipe, -1 means stdin */
+  int i = 0;
+  for(command_t * cmd = pipeline->first; cmd != NULL; cmd = cmd->next, i++){
+    int fds[2] = {-1, -1};
+    job->pids[i] = -1;
+    if (cmd->next != NULL && pipe2(fds, O_CLOEXEC) == -1) {
+      print_error_msg();
+      break;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (read_fd != -1) posix_spawn_file_actions_adddup2(&actions, read_fd, STDIN_FILENO);
+    if (fds[1] != -1) posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    if (redirect_spawned(&actions, cmd) != 0) {
+      print_error_msg(); /*  the command is skipped, its pipes are closed below */
+    } else {
+      struct timespec spawn_start;
+      clock_gettime(CLOCK_MONOTONIC, &spawn_start);
+      char * path = get_path_for_basename(cmd->argv[0]);
+      if (spawn_command(&job->pids[i], path, cmd->argv, &actions) == 0) job->running++;
+      else job->pids[i] = -1;
+      job->usage.spawn += elapsed_since(&spawn_start);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    if (read_fd != -1) close(read_fd);
+    if (fds[1] != -1) close(fds[1]);
+    read_fd = fds[0];
+  }
+  for(; i<job->pid_count; i++) job->pids[i] = -1; /*  not started after a failure */
+  if (read_fd != -1) close(read_fd); /*  only left open after a failure */
+}
+/**
+ * Block or unblock SIGCHLD, around every access to g_background outside
+ * of the handler.
+ *
+ * @param how : SIG_BLOCK or SIG_UNBLOCK.
+ */
+void mask_sigchld(int how){
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(how, &set, NULL);
+}
+/**
+ * SIGCHLD handler: reap the terminated processes of background jobs.
+ *
+ * Each background process is waited for by pid with WNOHANG, so zombies
+ * do not pile up while the shell waits for input, and foreground
+ * processes are left to the code waiting for them.
+ *
+ * @param signo
+ */
+void reap_background(int signo){
+  int saved_errno = errno; /*  the interrupted code may be checking it */
+  (void)signo;
+  for(int j=0; j<MAX_BACKGROUND_JOBS; j++){
+    job_t * job = &g_background[j];
+    for(int i=0; job->text != NULL && i<job->pid_count; i++){
+      int status;
+      struct rusage ru;
+      pid_t pid = job->pids[i];
+      if (pid != -1 && wait4(pid, &status, WNOHANG, &ru) == pid)
+        record_exit(job, i, status, &ru);
+    }
+  }
+  errno = saved_errno;
+}
+/**
+ * Record the exit of a background process reaped by a foreground wait4(-1).
+ *
+ * @param pid
+ * @param status : reported by wait4.
+ * @param ru : reported by wait4.
+ */
+void reap_background_process(pid_t pid, int status, struct rusage * ru){
+  mask_sigchld(SIG_BLOCK);
+  for(int j=0; j<MAX_BACKGROUND_JOBS; j++){
+    job_t * job = &g_background[j];
+    for(int i=0; job->text != NULL && i<job->pid_count; i++)
+      if (job->pids[i] == pid) record_exit(job, i, status, ru);
+  }
+  mask_sigchld(SIG_UNBLOCK);
+}
+/**
+ * Print a notice for each background job which has terminated, and free
+ * its slot.
+ *
+ * Called before each prompt, so notices do not interrupt a command.
+ */
+void notify_background(void){
+  mask_sigchld(SIG_BLOCK);
+  reap_background(0); /*  catch exits which happened before the job was registered */
+  for(int j=0; j<MAX_BACKGROUND_JOBS; j++){
+    job_t * job = &g_background[j];
+    if (job->text == NULL || job->running > 0) continue;
+    finish_job(job);
+    if (job->status == 0) printf("[%d] Done %.3fs %s\n", j + 1, job->usage.real, job->text);
+    else printf("[%d] Exit %d %.3fs %s\n", j + 1, job->status, job->usage.real, job->text);
+    free(job->pids);
+    free(job->text);
+    job->text = NULL;
+  }
+  mask_sigchld(SIG_UNBLOCK);
+}
+/**
+ * Start a pipeline in the background: the shell does not wait for it.
+ *
+ * @param pipeline
+ */
+void start_background(pipeline_t * pipeline){
+  int j = 0;
+  while(j < MAX_BACKGROUND_JOBS && g_background[j].text != NULL) j++;
+  if (j == MAX_BACKGROUND_JOBS) {
+    print_error_msg(); /*  too many jobs */
+    return;
+  }
+  job_t job;
+  char * text = pipeline_name(pipeline); /*  the line does not outlive this command */
+  /*  spawned with SIGCHLD unblocked, since children inherit the mask */
+  start_job(pipeline, &job);
+  if (job.running == 0) { /*  built-in, or nothing could start */
+    free(job.pids);
+    free(text);
+    return;
+  }
+  job.pipeline = NULL;
+  job.text = text;
+  mask_sigchld(SIG_BLOCK);
+  g_background[j] = job;
+  mask_sigchld(SIG_UNBLOCK);
+  printf("[%d] %d\n", j + 1, job.pids[job.pid_count - 1]);
+}
+/**
+ * jobs is a built-in command listing the running background jobs.
+ *
+ * @param cmd
+ *
+ * @return 0 if the program is 'jobs'. Otherwise -1.
+ */
+int list_jobs(command_t * cmd){
+  if (strcmp(cmd->argv[0], "jobs") != 0) return -1;
+  notify_background();
+  mask_sigchld(SIG_BLOCK);
+  for(int j=0; j<MAX_BACKGROUND_JOBS; j++){
+    job_t * job = &g_background[j];
+    if (job->text != NULL)
+      printf("[%d] Running %.3fs %s\n", j + 1, elapsed_since(&job->start), job->text);
+  }
+  mask_sigchld(SIG_UNBLOCK);
+  return 0;
+}
+/**
+ * wait is a built-in command waiting for background jobs.
+ *
+ * Without argument, it waits for every job; otherwise for the jobs whose
+ * numbers are given.
+ *
+ * @param cmd
+ *
+ * @return 0 if the program is 'wait'. Otherwise -1.
+ */
+int wait_jobs(command_t * cmd){
+  if (strcmp(cmd->argv[0], "wait") != 0) return -1;
+  for(int a=1; a<cmd->argc; a++){
+    int id = atoi(cmd->argv[a]);
+    if (id < 1 || id > MAX_BACKGROUND_JOBS || g_background[id - 1].text == NULL) {
+      print_error_msg(); /*  no such job */
       return 0;
     }
-    prev = strsep(line, "&");
   }
-  /*  wait for all children here: */
-  for (int i=0; i<children_count; i++) wait(NULL);
-  *line = prev;
+  /*  each process is reaped by the handler as soon as it exits, so the
+      runtime of a job does not depend on the order of waiting. */
+  sigset_t unblocked;
+  mask_sigchld(SIG_BLOCK);
+  sigprocmask(SIG_BLOCK, NULL, &unblocked);
+  sigdelset(&unblocked, SIGCHLD);
+  for(;;){
+    int running = 0;
+    reap_background(0);
+    for(int j=0; j<MAX_BACKGROUND_JOBS; j++){
+      int selected = (cmd->argc == 1);
+      for(int a=1; a<cmd->argc; a++) selected |= (atoi(cmd->argv[a]) == j + 1);
+      if (selected && g_background[j].text != NULL) running += g_background[j].running;
+    }
+    if (running == 0) break;
+    sigsuspend(&unblocked);
+  }
+  mask_sigchld(SIG_UNBLOCK);
+  notify_background();
   return 0;
 }
 /**
- * redirect stdout to valid output path.
+ * Execute parallel commands "cmd1 & cmd2 & ... & cmdN".
+ *
+ * Works like make -j: at most g_max_jobs jobs (pipelines) run at once.
+ * When one terminates (wait4(-1)), the next queued pipeline is started
+ * in its slot. Built-in commands run in the shell when their turn comes.
+ * The exit code of each job is kept in its job_t.
+ *
+ * @param group
+ *
+ * @return number of jobs which failed.
+ */
+int execute_parallel(group_t * group){
+  job_t * jobs = malloc(sizeof(job_t) * group->pipeline_count);
+  pipeline_t * next = group->first;
+  int started = 0, running = 0, failed = 0;
+
+  while(next != NULL || running > 0){
+    while(next != NULL && running < g_max_jobs){
+      start_job(next, &jobs[started]);
+      if (jobs[started++].running > 0) running++;
+      next = next->next;
+    }
+    if (running == 0) continue;
+    int status;
+    struct rusage ru;
+    pid_t pid = wait4(-1, &status, 0, &ru);
+    if (pid == -1) break; /*  no child left: should not happen */
+    int i;
+    for(i=0; i<started; i++){
+      if (jobs[i].running == 0 || reap_job_process(&jobs[i], pid, status, &ru) != 0)
+        continue;
+      if (jobs[i].running == 0) running--; /*  a slot is free */
+      break;
+    }
+    if (i == started) reap_background_process(pid, status, &ru);
+  }
+  for(int i=0; i<started; i++){
+    if (jobs[i].status != 0) failed++;
+    free(jobs[i].pids);
+  }
+  free(jobs);
+  return failed;
+}
+/**
+ * Replace the shell by the last command of a script.
+ *
+ * There is nothing left to do after the last command, so instead of
+ * spawning it and waiting, the shell applies the redirection to itself
+ * and calls execv. This is not done for built-in commands, pipelines,
+ * parallel commands, the time builtin or in profile mode, which all need
+ * the shell afterwards (the profile summary is printed by an atexit
+ * handler, which exec would skip).
+ *
+ * The exit status of the script is that of the command either way, as
+ * a batch script exits with the status of its last command line.
  *
- * @param line
+ * @param group : the parsed last line.
  *
- * @return -1 if output path is invalid, otherwise 0.
+ * @return -1 if the command is not eligible or cannot be executed;
+ *         otherwise it does not return.
  */
-int redirect_stdout_to_valid_file(char ** line){
-  char * path = malloc(MAX_PATH_LENGTH);
-  char * sign = ">";
-  int status = 0;
+int exec_last_command(group_t * group){
+  if (group->pipeline_count != 1 || group->first->stage_count != 1 ||
+      profile_enabled()) return -1;
+  command_t * cmd = group->first->first;
+  if (strcmp(cmd->argv[0], "time") == 0 || is_builtin_name(cmd->argv[0])) return -1;
+  char * path = get_path_for_basename(cmd->argv[0]);
+  if (path == NULL) return -1; /*  error is printed by the usual path */
+  if (redirect_in_shell(cmd) != 0) return -1;
+  fflush(stdout);
+  (void)execv(path, cmd->argv);
+  print_error_msg();
+  exit(127); /*  like a command which could not be started */
+}
+/**
+ * Parse and execute one command line.
+ *
+ * g_status is set to the exit code of the line: that of the pipeline, 1
+ * if a syntax error or a parallel command failed, 0 for built-in
+ * commands and background jobs. Comments and empty lines keep it.
+ *
+ * @param line : ends with '\n' or '\0', modified as a side effect.
+ * @param is_last : no command follows in the script.
+ */
+void execute_line(char * line, int is_last){
+  group_t group;
+  if (line[0] == '#') return; /*  ignore comment */
+  arena_reset(&g_arena);
+  if (parse_line(&g_arena, line, &group) != 0) {
+    print_error_msg(); /*  syntax error: nothing is executed */
+    g_status = 1;
+  } else if (group.pipeline_count == 0) {
+    return; /*  empty line */
+  } else if (group.background && g_stream == stdin) {
+    /*  scripts wait for "a & b &" like for "a & b", as the spec requires */
+    for(pipeline_t * pipeline = group.first; pipeline != NULL; pipeline = pipeline->next)
+      start_background(pipeline);
+    g_status = 0;
+  } else if (group.pipeline_count > 1) {
+    g_status = (execute_parallel(&group) == 0) ? 0 : 1;
+  } else {
+    job_t job;
+    if (is_last) (void)exec_last_command(&group);
+    start_job(group.first, &job);
+    g_status = wait_job(&job);
+    free(job.pids);
+  }
+}
+/**
+ * Find the most recent step with the given name.
+ *
+ * @param name
+ *
+ * @return index of the step, or -1.
+ */
+int dag_find_step(char * name){
+  for(int i=g_dag.count - 1; i>=0; i--)
+    if (g_dag.steps[i].name != NULL && strcmp(g_dag.steps[i].name, name) == 0)
+      return i;
+  return -1;
+}
+/**
+ * Read a "#step: name" or "#after: name..." annotation.
+ *
+ * Names are words, split by the command line parser. "#after:" may only
+ * name steps which appear earlier in the script, so the graph cannot have
+ * a cycle. Annotations apply to the next command line; an invalid one
+ * makes that command fail without running.
+ *
+ * @param line : starts with "#step:" or "#after:".
+ */
+void dag_annotate(char * line){
+  int is_step = (line[1] == 's');
+  group_t group;
+  command_t * names = NULL;
+  if (parse_line(&g_arena, line + (is_step ? 6 : 7), &group) != 0 ||
+      group.pipeline_count > 1) {
+    g_dag.invalid = 1;
+    return;
+  }
+  if (group.pipeline_count == 1) names = group.first->first;
+  if (names != NULL && (names->next != NULL || names->out_path != NULL)) {
+    g_dag.invalid = 1; /*  '|' or '>' in a name */
+    return;
+  }
+  if (is_step) {
+    if (names == NULL || names->argc != 1) g_dag.invalid = 1;
+    else g_dag.name = names->argv[0];
+    return;
+  }
+  for(int i=0; names != NULL && i<names->argc; i++){
+    int dep = dag_find_step(names->argv[i]);
+    if (dep == -1) {
+      g_dag.invalid = 1; /*  unknown, or not defined yet */
+      continue;
+    }
+    g_dag.after = realloc(g_dag.after, sizeof(int) * (g_dag.after_count + 1));
+    g_dag.after[g_dag.after_count++] = dep;
+  }
+}
+/**
+ * Mark a step and everything depending on it as skipped.
+ *
+ * @param i : index of the step.
+ */
+void dag_skip_step(int i){
+  step_t * step = &g_dag.steps[i];
+  if (step->state != STEP_WAITING) return;
+  step->state = STEP_SKIPPED;
+  print_error_msg();
+  for(int j=0; j<step->dependent_count; j++) dag_skip_step(step->dependents[j]);
+}
+/**
+ * Add one line of the script to the dependency graph.
+ *
+ * Every non-empty command line is a step. Lines which are not
+ * annotations are parsed as usual, a syntax error makes the step fail.
+ *
+ * @param line : ends with '\n' or '\0', it must live until dag_run.
+ * @param is_last : unused.
+ */
+void dag_add_line(char * line, int is_last){
+  group_t group;
+  (void)is_last;
+  if (strncmp(line, "#step:", 6) == 0 || strncmp(line, "#after:", 7) == 0) {
+    dag_annotate(line);
+    return;
+  }
+  if (line[0] == '#') return; /*  ignore comment */
+  int rc = parse_line(&g_arena, line, &group);
+  if (rc == 0 && group.pipeline_count == 0) return; /*  annotations wait for a command */
 
-  if ((*line)[0] == sign[0]) return -1;   /*  starting with '>' is invalid. */
-  int redirection_exists = get_output_path(&path, *line, sign);
-  (void)trim_string(&path);
-  for(int i=0; i< strlen(path); i++){ /* path with whitespace is invalid */
-    if(path[i] == ' ') return -1;
+  if (g_dag.count == g_dag.capacity){
+    g_dag.capacity = g_dag.capacity ? g_dag.capacity * 2 : 16;
+    g_dag.steps = realloc(g_dag.steps, sizeof(step_t) * g_dag.capacity);
+  }
+  int i = g_dag.count++;
+  step_t * step = &g_dag.steps[i];
+  memset(step, 0, sizeof(step_t));
+  step->name = g_dag.name;
+  step->group = group;
+  step->state = STEP_WAITING;
+  step->barrier = (rc == 0 && group.pipeline_count == 1 &&
+                   group.first->stage_count == 1 &&
+                   is_builtin_name(group.first->first->argv[0]));
+  if (rc != 0 || g_dag.invalid) {
+    print_error_msg();
+    step->state = STEP_FAILED;
+  }
+  for(int j=0; j<g_dag.after_count; j++){
+    step_t * dep = &g_dag.steps[g_dag.after[j]];
+    if (dep->state == STEP_FAILED || dep->state == STEP_SKIPPED) {
+      dag_skip_step(i);
+      continue;
+    }
+    dep->dependents = realloc(dep->dependents, sizeof(int) * (dep->dependent_count + 1));
+    dep->dependents[dep->dependent_count++] = i;
+    step->waiting++;
+  }
+  g_dag.name = NULL;
+  g_dag.after_count = 0;
+  g_dag.invalid = 0;
+}
+/**
+ * Record that a step has finished, and release the steps waiting for it.
+ *
+ * @param i : index of the step.
+ */
+void dag_finish_step(int i){
+  step_t * step = &g_dag.steps[i];
+  step->state = step->failed ? STEP_FAILED : STEP_DONE;
+  for(int j=0; j<step->dependent_count; j++){
+    int d = step->dependents[j];
+    if (step->failed) dag_skip_step(d);
+    else if (--g_dag.steps[d].waiting == 0 && d < g_dag.end &&
+             g_dag.steps[d].state == STEP_WAITING)
+      g_dag.ready[g_dag.ready_tail++] = d; /*  later segments queue it when they start */
+  }
+}
+/**
+ * Record that one job of a step has terminated.
+ *
+ * @param job
+ * @param i : index of the step which started job.
+ */
+void dag_finish_job(job_t * job, int i){
+  step_t * step = &g_dag.steps[i];
+  if (job->status != 0) step->failed = 1;
+  free(job->pids);
+  job->pids = NULL;
+  if (--step->running == 0 && step->next == NULL) dag_finish_step(i);
+}
+/**
+ * Run the ready steps of a segment, until none is left.
+ *
+ * Like execute_parallel, at most g_max_jobs jobs run at once and a slot
+ * is refilled as soon as wait4(-1) reports that its job terminated. The
+ * pipelines of a step ('&') take one slot each.
+ *
+ * @param slots : g_max_jobs jobs.
+ * @param owner : g_max_jobs step indices, -1 for a free slot.
+ */
+void dag_run_segment(job_t * slots, int * owner){
+  int busy = 0;
+  int current = -1; /*  step whose pipelines are being started */
+  for(;;){
+    while(busy < g_max_jobs){
+      if (current == -1) {
+        if (g_dag.ready_head == g_dag.ready_tail) break;
+        current = g_dag.ready[g_dag.ready_head++];
+        g_dag.steps[current].state = STEP_RUNNING;
+        g_dag.steps[current].next = g_dag.steps[current].group.first;
+      }
+      step_t * step = &g_dag.steps[current];
+      int k = 0;
+      while(owner[k] != -1) k++;
+      start_job(step->next, &slots[k]);
+      step->next = step->next->next;
+      step->running++;
+      int i = current;
+      if (step->next == NULL) current = -1; /*  every pipeline is started */
+      if (slots[k].running > 0) {
+        owner[k] = i;
+        busy++;
+      } else {
+        dag_finish_job(&slots[k], i); /*  built-in, or nothing could start */
+      }
+    }
+    if (busy == 0) break;
+    int status;
+    struct rusage ru;
+    pid_t pid = wait4(-1, &status, 0, &ru);
+    if (pid == -1) break; /*  no child left: should not happen */
+    for(int k=0; k<g_max_jobs; k++){
+      if (owner[k] == -1 || reap_job_process(&slots[k], pid, status, &ru) != 0)
+        continue;
+      if (slots[k].running == 0) {
+        int i = owner[k];
+        owner[k] = -1;
+        busy--;
+        dag_finish_job(&slots[k], i);
+      }
+      break;
+    }
   }
-  if (redirection_exists == 0) { /*  there is redirection sign? */
-    status=redirect_stdout_to_file(path);
-    *line = strsep(line,sign); /* keep the segment before '>' */
+}
+/**
+ * Count the steps before end which did not succeed.
+ *
+ * @param end : index of the first step not counted.
+ *
+ * @return number of steps which failed, were skipped or did not run.
+ */
+int dag_count_failed(int end){
+  int failed = 0;
+  for(int i=0; i<end; i++)
+    if (g_dag.steps[i].state != STEP_DONE) failed++;
+  return failed;
+}
+/**
+ * Run the steps of the dependency graph.
+ *
+ * A step starts once every step it names in "#after:" has succeeded;
+ * independent steps run concurrently. When a step fails, everything
+ * depending on it is skipped, while unrelated steps go on. Built-in
+ * commands change the shell for the steps after them, so each one is a
+ * barrier: the steps before it finish, then it runs alone.
+ *
+ * @return number of steps which failed or were skipped.
+ */
+int dag_run(void){
+  job_t * slots = malloc(sizeof(job_t) * g_max_jobs);
+  int * owner = malloc(sizeof(int) * g_max_jobs);
+  for(int k=0; k<g_max_jobs; k++) owner[k] = -1;
+  g_dag.ready = malloc(sizeof(int) * (g_dag.count + 1));
+  for(int begin = 0; begin < g_dag.count; begin = g_dag.end){
+    g_dag.end = begin;
+    while(g_dag.end < g_dag.count && !g_dag.steps[g_dag.end].barrier) g_dag.end++;
+    if (g_dag.end == begin) g_dag.end++; /*  a barrier is a segment of its own */
+    g_dag.ready_head = g_dag.ready_tail = 0;
+    for(int i=begin; i<g_dag.end; i++)
+      if (g_dag.steps[i].state == STEP_WAITING && g_dag.steps[i].waiting == 0)
+        g_dag.ready[g_dag.ready_tail++] = i;
+    dag_run_segment(slots, owner);
+  }
+  int failed = dag_count_failed(g_dag.count);
+  for(int i=0; i<g_dag.count; i++) free(g_dag.steps[i].dependents);
+  free(g_dag.steps);
+  free(g_dag.after);
+  free(g_dag.ready);
+  free(owner);
+  free(slots);
+  return failed;
+}
+/**
+ * Execute a script held in memory.
+ *
+ * The whole file is read at once, so lines are parsed in place without
+ * a getline call and copy per line.
+ *
+ * @param script : ends with '\0'.
+ * @param size : in bytes, without the '\0'.
+ * @param run_line : execute_line, or dag_add_line in -d mode.
+ */
+void execute_script(char * script, size_t size, void (*run_line)(char *, int)){
+  char * end = script + size;
+  char * line = script;
+  while(line < end){
+    char * newline = memchr(line, '\n', end - line);
+    char * next = (newline == NULL) ? end : newline + 1;
+    /*  the last line is only the last command if nothing but
+        whitespace follows it. */
+    char * rest = next;
+    while(rest < end && (*rest == ' ' || *rest == '\t' || *rest == '\n')) rest++;
+    run_line(line, rest == end);
+    line = next;
   }
-  return status;
+}
+/**
+ * Read a batch file into memory.
+ *
+ * The file is read rather than mapped: a script may truncate or rewrite
+ * its own file, and pages of a mapping which are no longer backed by the
+ * file would kill the shell with SIGBUS. The commands run are those the
+ * file held when the shell started.
+ *
+ * @param stream
+ * @param size : set to the number of bytes read.
+ *
+ * @return an allocated buffer ending with '\0', or NULL if the file is
+ *         empty, not a regular file or cannot be read.
+ */
+char * load_script(FILE * stream, size_t * size){
+  struct stat sb;
+  int fd = fileno(stream);
+  if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size == 0)
+    return NULL;
+  size_t capacity = sb.st_size + 1;
+  char * script = malloc(capacity);
+  ssize_t n;
+  *size = 0;
+  /*  do not trust st_size: the file may change while it is read */
+  while((n = read(fd, script + *size, capacity - 1 - *size)) > 0){
+    *size += n;
+    if (*size == capacity - 1) {
+      capacity *= 2;
+      script = realloc(script, capacity);
+    }
+  }
+  if (n == -1 || *size == 0) {
+    free(script);
+    lseek(fd, 0, SEEK_SET); /*  the caller falls back to getline */
+    return NULL;
+  }
+  script[*size] = '\0';
+  return script;
 }
 /**
  * print out prompt text in interactive mode
  *
  */
 void prompt(void){
-  if (g_stream == stdin) printf("wish> ");
+  if (g_stream != stdin) return;
+  notify_background();
+  printf("wish> ");
+}
+/**
+ * Read and execute lines typed on a terminal, with the line editor.
+ *
+ * History is kept in $WISH_HISTORY, or ~/.wish_history, and its index
+ * next to it.
+ */
+void interact(void){
+  char * line = NULL;
+  size_t len = 0;
+  char path[MAX_PATH_LENGTH + 1];
+  char * file = getenv("WISH_HISTORY");
+  char * home = getenv("HOME");
+  if (file == NULL && home != NULL) {
+    snprintf(path, sizeof(path), "%s/.wish_history", home);
+    file = path;
+  }
+  g_history.fd = g_history.index_fd = -1; /*  no history if it cannot be opened */
+  if (file != NULL) (void)history_open(&g_history, file);
+  lineedit_init(&g_history, g_paths, SEARCH_PATH_SIZE);
+  for(;;){
+    notify_background();
+    if (lineedit_read(&line, &len, "wish> ") == -1) break;
+    execute_line(line, 0);
+  }
+  exit(0);
 }
 /**
  * main function
@@ -251,49 +1050,76 @@ void prompt(void){
  * @param argc
  * @param argv
  *
- * @return
+ * @return a batch script exits with the status of its last command line,
+ *         in -d mode with 1 if a step failed; otherwise 0.
  */
 int main(int argc, char *argv[]){
   char * line = NULL;
   size_t len = 0; /*  len is unused. */
-  int stdout_copy = dup(1);
+  int c;
   g_paths[0] = strdup("/bin");
-  switch(argc){
-  case 2: g_stream = fopen(argv[1], "r"); break;
-  case 1: g_stream = stdin; prompt(); break;
+  while ((c = getopt(argc, argv, "dj:")) != -1){
+    if (c == 'd') g_dag_mode = 1;
+    else if (c != 'j' || (g_max_jobs = atoi(optarg)) < 1) {
+      print_error_msg();
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (g_max_jobs == 0){
+    /*  default to one job per CPU, but never run parallel commands
+        one after the other, even on a single CPU. */
+    g_max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (g_max_jobs < 2) g_max_jobs = 2;
+  }
+  char * profile = getenv("WISH_PROFILE");
+  if (profile != NULL && profile[0] != 0) profile_enable();
+  switch(argc - optind){
+  case 1:
+    g_stream = fopen(argv[optind], "r");
+    /*  not inherited by the last command, which replaces the shell */
+    if (g_stream != NULL) fcntl(fileno(g_stream), F_SETFD, FD_CLOEXEC);
+    break;
+  case 0: g_stream = stdin; break;
   default: print_error_msg(); exit(EXIT_FAILURE);
   }
-  if (g_stream == NULL) {
+  if (g_stream == NULL || (g_dag_mode && g_stream == stdin)) {
 	print_error_msg();
 	exit(EXIT_FAILURE);
   }
-  int program_pid = getpid();
+  if (g_stream == stdin) {
+    /*  reap background jobs as they terminate; SA_RESTART keeps getline
+        and foreground waits going */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = reap_background;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+    if (isatty(STDIN_FILENO)) interact();
+    prompt();
+  }
+  size_t size;
+  char * script = (g_stream == stdin) ? NULL : load_script(g_stream, &size);
+  if (g_dag_mode) {
+    /*  the whole graph is built before any step runs */
+    if (script != NULL) {
+      execute_script(script, size, dag_add_line);
+    } else {
+      while(-1 != getline(&line, &len, g_stream)){ /*  lines are kept in g_arena */
+        size_t n = strlen(line) + 1;
+        dag_add_line(memcpy(arena_alloc(&g_arena, n), line, n), 0);
+      }
+    }
+    exit(dag_run() == 0 ? 0 : EXIT_FAILURE);
+  }
+  if (script != NULL) {
+    execute_script(script, size, execute_line);
+    exit(g_status);
+  }
   /*  parse program arguments */
   while(-1 != getline(&line, &len, g_stream)){ /*  while not EOF */
-    line[strlen(line)-1] = 0; /*  remove newline at the end. */
-    if (line[0] == '#') continue ; /*  ignore comment */
-    if (execute_processes_in_parallel(&line) != 0 ||
-        redirect_stdout_to_valid_file(&line) != 0){
-      print_error_msg();
-      prompt();
-      continue;
-    }/*  invalid parallel execution or invalid redirection ? */
-    trim_string(&line);
-    if ( is_builtin_cmd(line) == 0 ||     /*  built-in commands */
-         strncmp(line, "", 1) == 0) { /* enter */
-      prompt();
-      continue;
-    }
-    pid_t pid = fork();     /*  fork and execute model */
-    if (pid == 0){
-      execute_command_after_fork(line);
-    } /*  child process */
-    else{
-      wait(NULL);
-      dup2(stdout_copy, 1); /*  restore standard output   */
-      if (program_pid != getpid()) exit(0);
-      prompt();
-    } /*  wait for the child process to end */
+    execute_line(line, 0);
+    prompt();
   }
-  exit(0);
+  exit(g_stream == stdin ? 0 : g_status);
 }